@@ -0,0 +1,33 @@
+# Some developers would be happier with the benchmark version provided from
+# their package manager. Use it if it is installed the package provide cmake
+# support.
+find_package(benchmark QUIET)
+
+if (benchmark_FOUND)
+  return()
+endif()
+
+option(FETCHCONTENT_UPDATES_DISCONNECTED TRUE)
+option(FETCHCONTENT_QUIET FALSE)
+include(FetchContent)
+
+FetchContent_Declare(benchmark
+  GIT_REPOSITORY "https://github.com/google/benchmark"
+  GIT_TAG        v1.8.3
+  GIT_PROGRESS   TRUE
+)
+
+FetchContent_GetProperties(benchmark)
+if(benchmark_POPULATED)
+  return()
+endif()
+
+FetchContent_Populate(benchmark)
+set(BENCHMARK_ENABLE_TESTING OFF CACHE INTERNAL "")
+set(BENCHMARK_ENABLE_GTEST_TESTS OFF CACHE INTERNAL "")
+set(BENCHMARK_ENABLE_INSTALL OFF CACHE INTERNAL "")
+add_subdirectory(
+  "${benchmark_SOURCE_DIR}"
+  "${benchmark_BINARY_DIR}"
+  EXCLUDE_FROM_ALL
+)
@@ -0,0 +1,177 @@
+#include "DataLoader.hpp"
+#include <algorithm>
+#include <assert.hpp>
+#include <chrono>
+#include <numeric>
+#include <random>
+#include "Trace.hpp"
+
+DataLoader::~DataLoader() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  condition_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+DataLoader& DataLoader::Input(BatchGenerator generator, int batch_floats) {
+  inputs_.push_back({std::move(generator), batch_floats});
+  return *this;
+}
+
+DataLoader& DataLoader::Size(int size) {
+  size_ = size;
+  return *this;
+}
+
+DataLoader& DataLoader::BatchSize(int batch_size) {
+  batch_size_ = batch_size;
+  return *this;
+}
+
+DataLoader& DataLoader::Batches(int batches) {
+  batches_ = batches;
+  return *this;
+}
+
+DataLoader& DataLoader::Prefetch(int prefetch) {
+  ASSERT(prefetch >= 1);
+  prefetch_ = prefetch;
+  return *this;
+}
+
+DataLoader& DataLoader::Workers(int workers) {
+  ASSERT(workers >= 1);
+  workers_ = workers;
+  return *this;
+}
+
+DataLoader& DataLoader::Shuffle(bool shuffle, unsigned int seed) {
+  shuffle_ = shuffle;
+  seed_ = seed;
+  return *this;
+}
+
+void DataLoader::Start() {
+  ASSERT(threads_.empty());
+
+  // Every worker needs a slot to fill, while the consumer holds another one.
+  slots_.resize(std::max(prefetch_, workers_ + 1));
+  for (Slot& slot : slots_) {
+    slot.batch.indices.resize(batch_size_);
+    for (const InputArguments& input : inputs_) {
+      slot.batch.inputs.emplace_back(input.batch_floats);
+    }
+  }
+
+  for (int i = 0; i < workers_; ++i) {
+    threads_.emplace_back([this] { Run(); });
+  }
+}
+
+const DataLoader::Batch& DataLoader::Next() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  ASSERT(consumed_ < batches_);
+
+  // The batch previously returned is no longer used.
+  released_ = consumed_;
+  condition_.notify_all();
+
+  Slot& slot = slots_[consumed_ % slots_.size()];
+  if (slot.ready != consumed_) {
+    TraceScope trace("data", "wait for batch");
+    const auto start = std::chrono::steady_clock::now();
+    condition_.wait(lock, [&] { return slot.ready == consumed_; });
+    const std::chrono::duration<double> stall =
+        std::chrono::steady_clock::now() - start;
+    stats_.stalls++;
+    stats_.stall_time += stall.count();
+  }
+
+  consumed_++;
+  stats_.batches = consumed_;
+  return slot.batch;
+}
+
+DataLoader::Stats DataLoader::stats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Stats stats = stats_;
+  stats.queue_depth = 0;
+  for (int k = consumed_; k < consumed_ + int(slots_.size()); ++k) {
+    stats.queue_depth += (slots_[k % slots_.size()].ready == k);
+  }
+  return stats;
+}
+
+void DataLoader::Run() {
+  const int slots = slots_.size();
+  while (true) {
+    int k = 0;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (scheduled_ >= batches_) {
+        return;
+      }
+      k = scheduled_++;
+      condition_.wait(lock,
+                      [&] { return stopping_ || k - released_ < slots; });
+      if (stopping_) {
+        return;
+      }
+    }
+
+    // The slot isn't shared with the consumer until `ready` is updated.
+    Batch& batch = slots_[k % slots].batch;
+    for (int i = 0; i < batch_size_; ++i) {
+      const int offset = k * batch_size_ + i;
+      batch.indices[i] = offset % size_;
+    }
+    if (shuffle_) {
+      std::shared_ptr<const std::vector<int>> permutation;
+      int epoch = -1;
+      for (int i = 0; i < batch_size_; ++i) {
+        const int offset = k * batch_size_ + i;
+        if (offset / size_ != epoch) {
+          epoch = offset / size_;
+          permutation = Permutation(epoch);
+        }
+        batch.indices[i] = (*permutation)[batch.indices[i]];
+      }
+    }
+    {
+      TraceScope trace("data", "input generation");
+      for (int i = 0; i < inputs_.size(); ++i) {
+        inputs_[i].generator(batch.indices, batch.inputs[i]);
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      slots_[k % slots].ready = k;
+    }
+    condition_.notify_all();
+  }
+}
+
+// Return the order in which the examples are visited during `epoch`.
+std::shared_ptr<const std::vector<int>> DataLoader::Permutation(int epoch) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  // Forget about the epochs no batch can use anymore.
+  const int oldest_epoch = (released_ * batch_size_) / size_;
+  permutations_.erase(permutations_.begin(),
+                      permutations_.lower_bound(oldest_epoch));
+
+  std::shared_ptr<const std::vector<int>>& permutation = permutations_[epoch];
+  if (!permutation) {
+    std::vector<int> order(size_);
+    std::iota(order.begin(), order.end(), 0);
+    std::mt19937 rng(seed_ + epoch);
+    std::shuffle(order.begin(), order.end(), rng);
+    permutation = std::make_shared<const std::vector<int>>(std::move(order));
+  }
+  return permutation;
+}
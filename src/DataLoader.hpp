@@ -0,0 +1,103 @@
+#ifndef DATA_LOADER_HPP
+#define DATA_LOADER_HPP
+
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Generator.hpp"
+
+// Produce the batches of inputs on a pool of background threads, ahead of
+// their use, so that the host prepares the next batches while the GPU trains
+// on the current one.
+//
+// Usage:
+// ------
+//  DataLoader loader;
+//  loader.Input(a_generator, a_batch_floats)
+//      .Size(100)
+//      .BatchSize(10)
+//      .Batches(10)
+//      .Workers(4)
+//      .Shuffle(true)
+//      .Start();
+//  for (int i = 0; i < 10; ++i) {
+//    const DataLoader::Batch& batch = loader.Next();
+//    ...
+//  }
+//
+// The generators are called concurrently from the worker threads, each
+// worker filling its own batch.
+class DataLoader {
+ public:
+  struct Batch {
+    std::vector<int> indices;
+    std::vector<std::vector<float>> inputs;  // One per Input().
+  };
+
+  struct Stats {
+    int batches = 0;          // Number of batches returned by Next().
+    int queue_depth = 0;      // Number of batches ready, and not yet used.
+    int stalls = 0;           // Number of times Next() had to wait.
+    double stall_time = 0.0;  // Total time spent waiting in Next(), in s.
+  };
+
+  DataLoader() = default;
+  ~DataLoader();
+
+  DataLoader& Input(BatchGenerator generator, int batch_floats);
+  DataLoader& Size(int size);
+  DataLoader& BatchSize(int batch_size);
+  DataLoader& Batches(int batches);
+  // The number of batches that can be prepared in advance.
+  DataLoader& Prefetch(int prefetch);
+  // The number of threads calling the generators.
+  DataLoader& Workers(int workers);
+  // Visit the examples in a different random order at every epoch.
+  DataLoader& Shuffle(bool shuffle, unsigned int seed = 0);
+
+  void Start();
+
+  // Block until the next batch is ready. The returned batch remains valid
+  // until the next call.
+  const Batch& Next();
+
+  Stats stats();
+
+ private:
+  void Run();
+  std::shared_ptr<const std::vector<int>> Permutation(int epoch);
+
+  struct InputArguments {
+    BatchGenerator generator;
+    int batch_floats;
+  };
+  std::vector<InputArguments> inputs_;
+  int size_ = 0;
+  int batch_size_ = 1;
+  int batches_ = 0;
+  int prefetch_ = 2;
+  int workers_ = 1;
+  bool shuffle_ = false;
+  unsigned int seed_ = 0;
+
+  // Ring of batches, shared with the worker threads.
+  struct Slot {
+    Batch batch;
+    int ready = -1;  // The index of the batch stored, once complete.
+  };
+  std::vector<Slot> slots_;
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  int scheduled_ = 0;  // Number of batches assigned to a worker.
+  int consumed_ = 0;   // Number of batches returned by Next().
+  int released_ = 0;   // Number of batches whose slot can be reused.
+  bool stopping_ = false;
+  std::map<int, std::shared_ptr<const std::vector<int>>> permutations_;
+  Stats stats_;
+};
+
+#endif  // DATA_LOADER_HPP
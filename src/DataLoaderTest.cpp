@@ -0,0 +1,60 @@
+#include <algorithm>
+#include <numeric>
+#include "DataLoader.hpp"
+#include "gtest/gtest.h"
+
+namespace {
+// Fill every example with its index.
+void Identity(std::span<const int> indices, std::span<float> batch) {
+  const int example_size = batch.size() / indices.size();
+  for (int i = 0; i < indices.size(); ++i) {
+    std::fill_n(batch.begin() + i * example_size, example_size, indices[i]);
+  }
+}
+}  // namespace
+
+TEST(DataLoader, Sequential) {
+  DataLoader loader;
+  loader.Input(Identity, 2 * 4)
+      .Size(10)
+      .BatchSize(4)
+      .Batches(5)
+      .Workers(3)
+      .Start();
+
+  for (int k = 0; k < 5; ++k) {
+    const DataLoader::Batch& batch = loader.Next();
+    for (int i = 0; i < 4; ++i) {
+      const int index = (k * 4 + i) % 10;
+      EXPECT_EQ(batch.indices[i], index);
+      EXPECT_EQ(batch.inputs[0][2 * i + 0], index);
+      EXPECT_EQ(batch.inputs[0][2 * i + 1], index);
+    }
+  }
+  EXPECT_EQ(loader.stats().batches, 5);
+}
+
+TEST(DataLoader, ShuffleVisitsEveryExampleOncePerEpoch) {
+  DataLoader loader;
+  loader.Input(Identity, 5)
+      .Size(20)
+      .BatchSize(5)
+      .Batches(8)
+      .Workers(2)
+      .Shuffle(true)
+      .Start();
+
+  for (int epoch = 0; epoch < 2; ++epoch) {
+    std::vector<int> visited;
+    for (int k = 0; k < 4; ++k) {
+      const DataLoader::Batch& batch = loader.Next();
+      visited.insert(visited.end(), batch.inputs[0].begin(),
+                     batch.inputs[0].end());
+    }
+    std::vector<int> expected(20);
+    std::iota(expected.begin(), expected.end(), 0);
+    EXPECT_NE(visited, expected);
+    std::sort(visited.begin(), visited.end());
+    EXPECT_EQ(visited, expected);
+  }
+}
@@ -0,0 +1,149 @@
+#include "DiskCache.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <vector>
+#include "fmt/format.h"
+
+namespace {
+
+class CachingPlatform : public dawn::platform::Platform {
+ public:
+  explicit CachingPlatform(dawn::platform::CachingInterface* cache)
+      : cache_(cache) {}
+
+  dawn::platform::CachingInterface* GetCachingInterface() override {
+    return cache_;
+  }
+
+ private:
+  dawn::platform::CachingInterface* cache_;
+};
+
+// 64-bit FNV-1a.
+uint64_t Hash(uint64_t hash, const void* data, size_t size) {
+  const auto* bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3;
+  }
+  return hash;
+}
+
+// A blob file holds the size of the key, the key, and the value. The key is
+// compared on load, to rule out hash collisions.
+bool ReadBlob(const std::string& path,
+              const void* key,
+              size_t key_size,
+              std::vector<char>* value) {
+  std::ifstream file(path, std::ios::binary);
+  uint64_t stored_key_size = 0;
+  if (!file.read(reinterpret_cast<char*>(&stored_key_size),
+                 sizeof(stored_key_size)) ||
+      stored_key_size != key_size) {
+    return false;
+  }
+
+  std::vector<char> stored_key(key_size);
+  if (!file.read(stored_key.data(), key_size) ||
+      std::memcmp(stored_key.data(), key, key_size) != 0) {
+    return false;
+  }
+
+  value->assign(std::istreambuf_iterator<char>(file),
+                std::istreambuf_iterator<char>());
+  return true;
+}
+
+}  // namespace
+
+DiskCache::DiskCache(std::string directory)
+    : directory_(std::move(directory)),
+      platform_(std::make_unique<CachingPlatform>(this)) {
+  std::error_code error;
+  std::filesystem::create_directories(directory_, error);
+  if (error) {
+    fmt::print(stderr, "Failed to create the cache directory {}: {}\n",
+               directory_, error.message());
+  }
+}
+
+DiskCache::~DiskCache() = default;
+
+void DiskCache::SetAdapter(std::string adapter) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  adapter_ = std::move(adapter);
+}
+
+DiskCache::Stats DiskCache::stats() const {
+  return {
+      .hits = hits_,
+      .misses = misses_,
+      .stores = stores_,
+  };
+}
+
+std::string DiskCache::Path(const void* key, size_t key_size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint64_t hash = 0xcbf29ce484222325;
+  hash = Hash(hash, adapter_.data(), adapter_.size());
+  hash = Hash(hash, key, key_size);
+  return fmt::format("{}/{:016x}.blob", directory_, hash);
+}
+
+size_t DiskCache::LoadData(const void* key,
+                           size_t key_size,
+                           void* value,
+                           size_t value_size) {
+  std::vector<char> blob;
+  if (!ReadBlob(Path(key, key_size), key, key_size, &blob)) {
+    // Dawn first asks for the size of the value, then for the value itself.
+    // Only the first call is counted.
+    if (!value) {
+      misses_++;
+    }
+    return 0;
+  }
+
+  if (!value) {
+    hits_++;
+    return blob.size();
+  }
+
+  if (value_size < blob.size()) {
+    return 0;
+  }
+  std::memcpy(value, blob.data(), blob.size());
+  return blob.size();
+}
+
+void DiskCache::StoreData(const void* key,
+                          size_t key_size,
+                          const void* value,
+                          size_t value_size) {
+  // Write to a temporary file, then rename it, so that concurrent processes
+  // never read a partial blob.
+  const std::string path = Path(key, key_size);
+  const std::string temporary_path =
+      fmt::format("{}.{:08x}.tmp", path, std::random_device()());
+  {
+    std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+    const uint64_t stored_key_size = key_size;
+    file.write(reinterpret_cast<const char*>(&stored_key_size),
+               sizeof(stored_key_size));
+    file.write(static_cast<const char*>(key), key_size);
+    file.write(static_cast<const char*>(value), value_size);
+    if (!file) {
+      return;
+    }
+  }
+
+  std::error_code error;
+  std::filesystem::rename(temporary_path, path, error);
+  if (error) {
+    std::filesystem::remove(temporary_path, error);
+    return;
+  }
+  stores_++;
+}
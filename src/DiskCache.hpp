@@ -0,0 +1,57 @@
+#ifndef DISK_CACHE_HPP
+#define DISK_CACHE_HPP
+
+#include <dawn/platform/DawnPlatform.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Persist the blobs Dawn caches, like the compiled shaders and pipelines, as
+// files in a directory, so that they survive restarts of the process.
+//
+// Blobs are stored per adapter and driver, see SetAdapter(). Dawn may access
+// the cache from its own threads.
+class DiskCache : public dawn::platform::CachingInterface {
+ public:
+  explicit DiskCache(std::string directory);
+  ~DiskCache() override;
+
+  // The platform to give to the Dawn instance, so that it uses this cache.
+  dawn::platform::Platform* Platform() { return platform_.get(); }
+
+  // Blobs compiled on another adapter or driver are never used.
+  void SetAdapter(std::string adapter);
+
+  struct Stats {
+    int hits = 0;
+    int misses = 0;
+    int stores = 0;
+  };
+  Stats stats() const;
+
+  // dawn::platform::CachingInterface:
+  size_t LoadData(const void* key,
+                  size_t key_size,
+                  void* value,
+                  size_t value_size) override;
+  void StoreData(const void* key,
+                 size_t key_size,
+                 const void* value,
+                 size_t value_size) override;
+
+ private:
+  std::string Path(const void* key, size_t key_size);
+
+  std::string directory_;
+  std::unique_ptr<dawn::platform::Platform> platform_;
+
+  std::mutex mutex_;
+  std::string adapter_;
+
+  std::atomic<int> hits_ = 0;
+  std::atomic<int> misses_ = 0;
+  std::atomic<int> stores_ = 0;
+};
+
+#endif  // DISK_CACHE_HPP
@@ -0,0 +1,44 @@
+#include <filesystem>
+#include <string>
+#include "DiskCache.hpp"
+#include "gtest/gtest.h"
+
+TEST(DiskCache, StoreAndLoad) {
+  const std::string directory =
+      (std::filesystem::temp_directory_path() / "neural-webgpu-disk-cache")
+          .string();
+  std::filesystem::remove_all(directory);
+
+  const std::string key = "key";
+  const std::string value = "compiled pipeline";
+  {
+    DiskCache cache(directory);
+    cache.SetAdapter("adapter");
+    EXPECT_EQ(cache.LoadData(key.data(), key.size(), nullptr, 0), 0);
+    cache.StoreData(key.data(), key.size(), value.data(), value.size());
+    EXPECT_EQ(cache.stats().misses, 1);
+    EXPECT_EQ(cache.stats().stores, 1);
+  }
+
+  // A new process on the same adapter finds the value.
+  {
+    DiskCache cache(directory);
+    cache.SetAdapter("adapter");
+    std::string loaded(cache.LoadData(key.data(), key.size(), nullptr, 0), 0);
+    ASSERT_EQ(loaded.size(), value.size());
+    cache.LoadData(key.data(), key.size(), loaded.data(), loaded.size());
+    EXPECT_EQ(loaded, value);
+    EXPECT_EQ(cache.stats().hits, 1);
+    EXPECT_EQ(cache.stats().misses, 0);
+  }
+
+  // Another adapter doesn't.
+  {
+    DiskCache cache(directory);
+    cache.SetAdapter("another adapter");
+    EXPECT_EQ(cache.LoadData(key.data(), key.size(), nullptr, 0), 0);
+    EXPECT_EQ(cache.stats().misses, 1);
+  }
+
+  std::filesystem::remove_all(directory);
+}
@@ -1,5 +1,10 @@
 #include "GPU.hpp"
+#include <regex>
 #include <set>
+#include <dawn/native/DawnNative.h>
+#include "DiskCache.hpp"
+#include "GPUProfiler.hpp"
+#include "Trace.hpp"
 #include "fmt/format.h"
 
 namespace {
@@ -55,14 +60,47 @@ void OnDeviceLost(WGPUDeviceLostReason reason,
   WithGPU(userdata, [&](GPU* gpu) { gpu->OnDeviceLost(reason, message); });
 }
 
+struct ComputePipelineRequest {
+  GPU* gpu;
+  GPU::PipelineKey key;
+};
+
+void OnComputePipelineCreated(WGPUCreatePipelineAsyncStatus status,
+                              WGPUComputePipeline pipeline,
+                              char const* message,
+                              void* userdata) {
+  auto* request = static_cast<ComputePipelineRequest*>(userdata);
+  WithGPU(request->gpu, [&](GPU* gpu) {
+    gpu->OnComputePipelineCreated(request->key, status, pipeline);
+  });
+  delete request;
+}
+
 }  // namespace cGPU
 }  // namespace
 
-GPU::GPU() {
+GPU::GPU() : GPU(GPUOptions()) {}
+
+GPU::GPU(GPUOptions gpu_options) {
   AddGPU(this);
-  instance_ = wgpu::CreateInstance();
+  half_precision_ = gpu_options.half_precision;
+  profile_ = gpu_options.profile;
+
+  // Dawn reads and writes its blob cache through the platform of the
+  // instance.
+  dawn::native::DawnInstanceDescriptor dawn_instance_descriptor;
+  if (!gpu_options.cache_directory.empty()) {
+    disk_cache_ = std::make_unique<DiskCache>(gpu_options.cache_directory);
+    dawn_instance_descriptor.platform = disk_cache_->Platform();
+  }
+  wgpu::InstanceDescriptor instance_descriptor{
+      .nextInChain = &dawn_instance_descriptor,
+  };
+  instance_ = wgpu::CreateInstance(&instance_descriptor);
+
   wgpu::RequestAdapterOptions options{
       //.powerPreference = wgpu::PowerPreference::HighPerformance,
+      .forceFallbackAdapter = gpu_options.software_adapter,
   };
   instance_.RequestAdapter(&options, cGPU::OnAdapterFound,
                            reinterpret_cast<void*>(this));
@@ -72,6 +110,298 @@ GPU::~GPU() {
   RemoveGPU(this);
 }
 
+void GPU::BeginStep() {
+  if (step_depth_++ == 0) {
+    encoder_ = device_.CreateCommandEncoder();
+  }
+}
+
+void GPU::EndStep() {
+  if (--step_depth_ != 0) {
+    return;
+  }
+
+  Flush();
+  encoder_ = nullptr;
+}
+
+void GPU::Flush() {
+  if (!encoder_) {
+    return;
+  }
+
+  Encoder();  // End the compute pass.
+  if (profiler_) {
+    profiler_->BeforeSubmit(encoder_);
+  }
+  wgpu::CommandBuffer commands = encoder_.Finish();
+  device_.GetQueue().Submit(1, &commands);
+  if (profiler_) {
+    profiler_->AfterSubmit();
+  }
+
+  if (step_depth_ != 0) {
+    encoder_ = device_.CreateCommandEncoder();
+  }
+
+  std::vector<std::function<void()>> callbacks = std::move(after_submit_);
+  after_submit_.clear();
+  for (auto& callback : callbacks) {
+    callback();
+  }
+}
+
+void GPU::AfterSubmit(std::function<void()> callback) {
+  if (step_depth_ == 0) {
+    callback();
+    return;
+  }
+  after_submit_.push_back(std::move(callback));
+}
+
+void GPU::Poll() {
+  instance_.ProcessEvents();
+}
+
+bool GPU::WaitAny() {
+  if (pending_operations_ == 0) {
+    return false;
+  }
+
+  TraceScope trace("gpu", "ProcessEvents");
+  const int completed = completed_operations_;
+  while (completed_operations_ == completed) {
+    instance_.ProcessEvents();
+  }
+  return true;
+}
+
+void GPU::WaitAll() {
+  while (WaitAny()) {
+  }
+}
+
+wgpu::ComputePassEncoder& GPU::ComputePass() {
+  if (!compute_pass_) {
+    compute_pass_ = encoder_.BeginComputePass();
+  }
+  return compute_pass_;
+}
+
+wgpu::CommandEncoder& GPU::Encoder() {
+  if (compute_pass_) {
+    compute_pass_.End();
+    compute_pass_ = nullptr;
+  }
+  return encoder_;
+}
+
+void GPU::Record(const GPUCommand& command) {
+  if (capture_) {
+    capture_->push_back(command);
+    return;
+  }
+
+  BeginStep();
+  if (command.pipeline && profiler_) {
+    profiler_->Dispatch(command);
+  } else if (command.pipeline) {
+    wgpu::ComputePassEncoder& compute_pass = ComputePass();
+    compute_pass.SetPipeline(command.pipeline);
+    compute_pass.SetBindGroup(0, command.bind_group);
+    compute_pass.DispatchWorkgroups(command.x, command.y, command.z);
+  } else {
+    Encoder().CopyBufferToBuffer(command.source, command.source_offset,
+                                 command.destination,
+                                 command.destination_offset, command.size);
+  }
+  EndStep();
+}
+
+void GPU::SetProfileScope(std::string node, std::string phase) {
+  profile_node_ = std::move(node);
+  profile_phase_ = std::move(phase);
+}
+
+void GPU::BeginCapture(std::vector<GPUCommand>* commands) {
+  capture_ = commands;
+}
+
+void GPU::EndCapture() {
+  capture_ = nullptr;
+}
+
+wgpu::Buffer GPU::AcquireReadbackBuffer(uint64_t size) {
+  // Round up to a power of two, so that buffers can be reused across sizes.
+  uint64_t bucket = 256;
+  while (bucket < size) {
+    bucket *= 2;
+  }
+
+  std::vector<wgpu::Buffer>& buffers = readback_buffers_[bucket];
+  if (!buffers.empty()) {
+    wgpu::Buffer buffer = buffers.back();
+    buffers.pop_back();
+    return buffer;
+  }
+
+  wgpu::BufferDescriptor descriptor = {
+      .label = "Readback buffer",
+      .usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::MapRead,
+      .size = bucket,
+      .mappedAtCreation = false,
+  };
+  return device_.CreateBuffer(&descriptor);
+}
+
+void GPU::ReleaseReadbackBuffer(wgpu::Buffer buffer) {
+  readback_buffers_[buffer.GetSize()].push_back(buffer);
+}
+
+GPU::CacheStats GPU::PipelineCacheStats() const {
+  if (!disk_cache_) {
+    return {};
+  }
+  DiskCache::Stats stats = disk_cache_->stats();
+  return {
+      .hits = stats.hits,
+      .misses = stats.misses,
+      .stores = stats.stores,
+  };
+}
+
+wgpu::ShaderModule GPU::CachedShaderModule(const std::string& code) {
+  auto it = shader_modules_.find(code);
+  if (it != shader_modules_.end()) {
+    return it->second;
+  }
+
+  wgpu::ShaderModuleWGSLDescriptor wgslDesc;
+  wgslDesc.code = code.c_str();
+  wgpu::ShaderModuleDescriptor shaderModuleDescriptor{
+      .nextInChain = &wgslDesc,
+  };
+  wgpu::ShaderModule module =
+      device_.CreateShaderModule(&shaderModuleDescriptor);
+  shader_modules_[code] = module;
+
+  // Remember the compute entry points, to compile them ahead of time.
+  static const std::regex entry_point(R"(@compute[^{]*?\bfn\s+(\w+))");
+  std::vector<std::string>& entry_points = entry_points_[module.Get()];
+  for (auto match = std::sregex_iterator(code.begin(), code.end(), entry_point);
+       match != std::sregex_iterator(); ++match) {
+    entry_points.push_back((*match)[1]);
+  }
+  return module;
+}
+
+const GPU::Layout& GPU::CachedLayout(const Bindings& bindings) {
+  auto it = layouts_.find(bindings);
+  if (it != layouts_.end()) {
+    return it->second;
+  }
+
+  std::vector<wgpu::BindGroupLayoutEntry> bindGroupLayoutEntries;
+  for (auto [binding, size] : bindings) {
+    bindGroupLayoutEntries.push_back({
+        .binding = binding,
+        .visibility = wgpu::ShaderStage::Compute,
+        .buffer =
+            {
+                .type = wgpu::BufferBindingType::Storage,
+                .minBindingSize = size,
+            },
+    });
+  }
+
+  wgpu::BindGroupLayoutDescriptor bindGroupLayoutDescriptor{
+      .label = "Bind group layout",
+      .entryCount = bindGroupLayoutEntries.size(),
+      .entries = bindGroupLayoutEntries.data(),
+  };
+
+  Layout layout;
+  layout.bind_group_layout =
+      device_.CreateBindGroupLayout(&bindGroupLayoutDescriptor);
+
+  wgpu::PipelineLayoutDescriptor pipelineLayoutDescriptor{
+      .label = "Pipeline layout",
+      .bindGroupLayoutCount = 1,
+      .bindGroupLayouts = &layout.bind_group_layout,
+  };
+  layout.pipeline_layout =
+      device_.CreatePipelineLayout(&pipelineLayoutDescriptor);
+
+  return layouts_[bindings] = layout;
+}
+
+wgpu::ComputePipeline GPU::CachedComputePipeline(
+    wgpu::ShaderModule module,
+    wgpu::PipelineLayout layout,
+    const std::string& entrypoint) {
+  // The modules and layouts are kept alive by their own caches, so their
+  // handles can't be reused by other objects.
+  CachedPipeline& cached =
+      compute_pipelines_[{module.Get(), layout.Get(), entrypoint}];
+  while (cached.compiling) {
+    instance_.ProcessEvents();
+  }
+  if (cached.pipeline) {
+    return cached.pipeline;
+  }
+
+  wgpu::ComputePipelineDescriptor description = {
+      .label = "Compute pipeline",
+      .layout = layout,
+      .compute =
+          {
+              .module = module,
+              .entryPoint = entrypoint.c_str(),
+          },
+  };
+  cached.pipeline = device_.CreateComputePipeline(&description);
+  return cached.pipeline;
+}
+
+void GPU::PrecompileComputePipelines(wgpu::ShaderModule module,
+                                     wgpu::PipelineLayout layout) {
+  for (const std::string& entrypoint : entry_points_[module.Get()]) {
+    PipelineKey key = {module.Get(), layout.Get(), entrypoint};
+    CachedPipeline& cached = compute_pipelines_[key];
+    if (cached.pipeline || cached.compiling) {
+      continue;
+    }
+    cached.compiling = true;
+
+    wgpu::ComputePipelineDescriptor description = {
+        .label = "Compute pipeline",
+        .layout = layout,
+        .compute =
+            {
+                .module = module,
+                .entryPoint = entrypoint.c_str(),
+            },
+    };
+    device_.CreateComputePipelineAsync(
+        &description, cGPU::OnComputePipelineCreated,
+        new cGPU::ComputePipelineRequest{this, std::move(key)});
+  }
+}
+
+void GPU::OnComputePipelineCreated(const PipelineKey& key,
+                                   WGPUCreatePipelineAsyncStatus status,
+                                   WGPUComputePipeline pipeline) {
+  CachedPipeline& cached = compute_pipelines_[key];
+  cached.compiling = false;
+
+  // Entry points not compatible with the layout fail to compile. For
+  // instance, the backward pass of inference-only nodes. They are compiled
+  // again, synchronously, only if they are used, to report the error.
+  if (status == WGPUCreatePipelineAsyncStatus_Success) {
+    cached.pipeline = wgpu::ComputePipeline::Acquire(pipeline);
+  }
+}
+
 void GPU::OnAdapterFound(WGPURequestAdapterStatus status,
                          WGPUAdapter adapter_handle,
                          char const* message) {
@@ -91,8 +421,34 @@ void GPU::OnAdapterFound(WGPURequestAdapterStatus status,
   name_ = properties.name;
   driver_description_ = properties.driverDescription;
 
+  if (disk_cache_) {
+    disk_cache_->SetAdapter(fmt::format("{} {} {} {} {}", properties.vendorID,
+                                        properties.deviceID, name_,
+                                        architecture_, driver_description_));
+  }
+
+  // Fall back to f32 when f16 is not supported.
+  std::vector<wgpu::FeatureName> features;
+  half_precision_ =
+      half_precision_ && adapter_.HasFeature(wgpu::FeatureName::ShaderF16);
+  if (half_precision_) {
+    features.push_back(wgpu::FeatureName::ShaderF16);
+  }
+  packed_dot_product_ =
+      adapter_.HasFeature(wgpu::FeatureName::ChromiumExperimentalDp4a);
+  if (packed_dot_product_) {
+    features.push_back(wgpu::FeatureName::ChromiumExperimentalDp4a);
+  }
+  timestamp_query_ =
+      profile_ && adapter_.HasFeature(wgpu::FeatureName::TimestampQuery);
+  if (timestamp_query_) {
+    features.push_back(wgpu::FeatureName::TimestampQuery);
+  }
+
   wgpu::DeviceDescriptor device_descriptor{
       .label = "neural-webgpu device",
+      .requiredFeatureCount = features.size(),
+      .requiredFeatures = features.data(),
       .deviceLostCallback = cGPU::OnDeviceLost,
       .deviceLostUserdata = nullptr,
   };
@@ -114,6 +470,10 @@ void GPU::OnDeviceFound(WGPURequestDeviceStatus status,
   // Add an error callback for more debug info
   device_.SetUncapturedErrorCallback(cGPU::OnError,
                                      reinterpret_cast<void*>(this));
+
+  if (profile_) {
+    profiler_ = std::make_unique<GPUProfiler>(*this, timestamp_query_);
+  }
 }
 
 void GPU::OnError(WGPUErrorType type, char const* message) {
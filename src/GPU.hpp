@@ -2,11 +2,68 @@
 #define GPU_HPP
 
 #include <webgpu/webgpu_cpp.h>
+#include <functional>
+#include <map>
+#include <memory>
 #include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class DiskCache;
+class GPUProfiler;
+class Tensor;
+
+// A unit of GPU work: either a compute dispatch, or a buffer copy.
+struct GPUCommand {
+  // Dispatch:
+  wgpu::ComputePipeline pipeline;
+  wgpu::BindGroup bind_group;
+  uint32_t x = 1;
+  uint32_t y = 1;
+  uint32_t z = 1;
+
+  // Copy:
+  wgpu::Buffer source;
+  uint64_t source_offset = 0;
+  wgpu::Buffer destination;
+  uint64_t destination_offset = 0;
+  uint64_t size = 0;
+
+  // The tensors used by the command, for memory planning.
+  std::vector<Tensor*> tensors;
+
+  // Where the dispatch comes from, for the profiler.
+  std::string node;
+  std::string phase;
+  std::string entry_point;
+};
+
+struct GPUOptions {
+  // When set, the compiled shaders and pipelines are persisted in this
+  // directory, and reused by the next processes running on the same adapter
+  // and driver.
+  std::string cache_directory;
+
+  // Store the tensors as f16 instead of f32, halving their memory and
+  // bandwidth. Only used when the adapter supports the shader-f16 feature.
+  // See GPU::HalfPrecision().
+  bool half_precision = false;
+
+  // Measure the time of every dispatch, see GPU::Profiler(). Uses the
+  // timestamp-query feature when the adapter supports it.
+  bool profile = false;
+
+  // Use the software adapter, like SwiftShader, instead of the hardware one.
+  // SwiftShader is built with the SWIFTSHADER CMake option.
+  bool software_adapter = false;
+};
 
 class GPU {
  public:
   GPU();
+  explicit GPU(GPUOptions options);
   ~GPU();
 
   wgpu::Instance& Instance() { return instance_; }
@@ -17,6 +74,94 @@ class GPU {
   const std::string& Name() { return name_; }
   const std::string& DriverDescription() { return driver_description_; }
 
+  // Whether the tensors are stored as f16. The shaders use the `real` type,
+  // aliased to f16 or f32 accordingly, see Shader().
+  bool HalfPrecision() const { return half_precision_; }
+
+  // Whether the shaders can use the hardware's dot4I8Packed(). Otherwise,
+  // Shader() emulates it, see dot4_i8().
+  bool PackedDotProduct() const { return packed_dot_product_; }
+
+  // The profiler, when enabled by GPUOptions::profile. Null otherwise.
+  GPUProfiler* Profiler() { return profiler_.get(); }
+  // The node and the phase of the dispatches recorded next, for the profiler.
+  void SetProfileScope(std::string node, std::string phase);
+  const std::string& ProfileNode() const { return profile_node_; }
+  const std::string& ProfilePhase() const { return profile_phase_; }
+
+  // Command recording:
+  // Outside of a step, every dispatch and copy is submitted on its own.
+  // Between BeginStep() and EndStep(), they are appended to a single command
+  // encoder, and submitted once when the outermost step ends. Steps can be
+  // nested.
+  // Note: Queue writes issued during a step take effect before the step's
+  // commands.
+  void BeginStep();
+  void EndStep();
+  // Submit the commands recorded so far, and continue recording.
+  void Flush();
+  // The compute pass of the current step. It is begun when needed.
+  wgpu::ComputePassEncoder& ComputePass();
+  // The command encoder of the current step. The compute pass is ended when
+  // needed.
+  wgpu::CommandEncoder& Encoder();
+
+  // Record a command into the current step. While capturing, the command is
+  // appended to the capture list instead of being executed.
+  void Record(const GPUCommand& command);
+  void BeginCapture(std::vector<GPUCommand>* commands);
+  void EndCapture();
+
+  // Asynchronous operations:
+  // Run `callback` once the commands recorded so far are submitted.
+  void AfterSubmit(std::function<void()> callback);
+  // Track an asynchronous operation, from its start to its completion.
+  void BeginAsync() { pending_operations_++; }
+  void EndAsync() { pending_operations_--; completed_operations_++; }
+  int PendingOperations() const { return pending_operations_; }
+  // Process the completed operations, and call their callbacks. Doesn't block.
+  void Poll();
+  // Block until at least one pending operation completes. Returns false if
+  // there were none.
+  bool WaitAny();
+  // Block until every pending operation completes.
+  void WaitAll();
+
+  // A pool of buffers to read data back from the GPU. A released buffer must
+  // be unmapped.
+  wgpu::Buffer AcquireReadbackBuffer(uint64_t size);
+  void ReleaseReadbackBuffer(wgpu::Buffer buffer);
+
+  // The on-disk cache of compiled pipelines, see GPUOptions::cache_directory.
+  struct CacheStats {
+    int hits = 0;    // Blobs loaded from the disk.
+    int misses = 0;  // Blobs compiled, because they weren't on the disk.
+    int stores = 0;  // Blobs written to the disk.
+  };
+  CacheStats PipelineCacheStats() const;
+
+  // Caches of compiled objects, shared by every node of the GPU, so that
+  // identical layers compile their shaders and pipelines only once:
+  // Shader modules, keyed on their WGSL source.
+  wgpu::ShaderModule CachedShaderModule(const std::string& code);
+  // Layouts of a single bind group of storage buffers, keyed on the binding
+  // numbers and their minimum sizes in bytes.
+  struct Layout {
+    wgpu::BindGroupLayout bind_group_layout;
+    wgpu::PipelineLayout pipeline_layout;
+  };
+  using Bindings = std::vector<std::pair<uint32_t, uint64_t>>;
+  const Layout& CachedLayout(const Bindings& bindings);
+  // Compute pipelines, keyed on their module, layout and entry point. Waits
+  // for the pipeline if it is still compiling.
+  wgpu::ComputePipeline CachedComputePipeline(wgpu::ShaderModule module,
+                                              wgpu::PipelineLayout layout,
+                                              const std::string& entrypoint);
+  // Start compiling the pipelines of every compute entry point of `module`,
+  // in parallel and in the background.
+  void PrecompileComputePipelines(wgpu::ShaderModule module,
+                                  wgpu::PipelineLayout layout);
+
  public:
   void OnAdapterFound(WGPURequestAdapterStatus status,
                       WGPUAdapter adapter_handle,
@@ -26,16 +171,50 @@ class GPU {
                      char const* message);
   void OnError(WGPUErrorType type, char const* message);
   void OnDeviceLost(WGPUDeviceLostReason reason, char const* message);
+  using PipelineKey =
+      std::tuple<WGPUShaderModule, WGPUPipelineLayout, std::string>;
+  void OnComputePipelineCreated(const PipelineKey& key,
+                                WGPUCreatePipelineAsyncStatus status,
+                                WGPUComputePipeline pipeline);
 
  private:
+  std::unique_ptr<DiskCache> disk_cache_;
+  std::unique_ptr<GPUProfiler> profiler_;
+  bool profile_ = false;
+  bool timestamp_query_ = false;
+  std::string profile_node_;
+  std::string profile_phase_;
   wgpu::Instance instance_;
   wgpu::Device device_;
   wgpu::Adapter adapter_;
 
+  int step_depth_ = 0;
+  wgpu::CommandEncoder encoder_;
+  wgpu::ComputePassEncoder compute_pass_;
+  std::vector<GPUCommand>* capture_ = nullptr;
+  std::vector<std::function<void()>> after_submit_;
+  int pending_operations_ = 0;
+  int completed_operations_ = 0;
+
+  // Readback buffers, indexed by their size.
+  std::map<uint64_t, std::vector<wgpu::Buffer>> readback_buffers_;
+
+  std::unordered_map<std::string, wgpu::ShaderModule> shader_modules_;
+  std::map<Bindings, Layout> layouts_;
+  std::unordered_map<WGPUShaderModule, std::vector<std::string>>
+      entry_points_;
+  struct CachedPipeline {
+    wgpu::ComputePipeline pipeline;
+    bool compiling = false;
+  };
+  std::map<PipelineKey, CachedPipeline> compute_pipelines_;
+
   std::string vendor_name_;
   std::string architecture_;
   std::string name_;
   std::string driver_description_;
+  bool half_precision_ = false;
+  bool packed_dot_product_ = false;
 };
 
 #endif // GPU_HPP
@@ -0,0 +1,224 @@
+#include "GPUProfiler.hpp"
+
+#include <algorithm>
+#include "fmt/format.h"
+
+namespace {
+
+// The dispatches timed per submission. Two timestamps each.
+constexpr uint32_t kMaxDispatches = 1024;
+
+}  // namespace
+
+GPUProfiler::GPUProfiler(GPU& gpu, bool timestamps)
+    : gpu_(gpu), timestamps_(timestamps) {
+  if (!timestamps_) {
+    return;
+  }
+
+  wgpu::QuerySetDescriptor query_set_descriptor{
+      .label = "GPUProfiler queries",
+      .type = wgpu::QueryType::Timestamp,
+      .count = 2 * kMaxDispatches,
+  };
+  query_set_ = gpu_.Device().CreateQuerySet(&query_set_descriptor);
+
+  wgpu::BufferDescriptor buffer_descriptor{
+      .label = "GPUProfiler resolve buffer",
+      .usage = wgpu::BufferUsage::QueryResolve | wgpu::BufferUsage::CopySrc,
+      .size = 2 * kMaxDispatches * sizeof(uint64_t),
+      .mappedAtCreation = false,
+  };
+  resolve_buffer_ = gpu_.Device().CreateBuffer(&buffer_descriptor);
+}
+
+GPUProfiler::~GPUProfiler() {
+  if (query_set_) {
+    query_set_.Destroy();
+  }
+}
+
+void GPUProfiler::Dispatch(const GPUCommand& command) {
+  const Key key = {command.node, command.phase, command.entry_point};
+
+  if (!timestamps_) {
+    // Complete the previous commands first, so that they aren't timed.
+    gpu_.Flush();
+    WaitForQueue();
+    const Clock::time_point start = Clock::now();
+    wgpu::ComputePassEncoder& compute_pass = gpu_.ComputePass();
+    compute_pass.SetPipeline(command.pipeline);
+    compute_pass.SetBindGroup(0, command.bind_group);
+    compute_pass.DispatchWorkgroups(command.x, command.y, command.z);
+    gpu_.Flush();
+    if (WaitForQueue()) {
+      Add(key, std::chrono::duration<double, std::milli>(Clock::now() - start)
+                   .count());
+    }
+    return;
+  }
+
+  if (pending_.size() == kMaxDispatches) {
+    gpu_.Flush();
+  }
+  const uint32_t query = 2 * pending_.size();
+  pending_.push_back(key);
+
+  wgpu::ComputePassTimestampWrites timestamp_writes{
+      .querySet = query_set_,
+      .beginningOfPassWriteIndex = query,
+      .endOfPassWriteIndex = query + 1,
+  };
+  wgpu::ComputePassDescriptor descriptor{
+      .label = "GPUProfiler pass",
+      .timestampWrites = &timestamp_writes,
+  };
+  wgpu::ComputePassEncoder compute_pass =
+      gpu_.Encoder().BeginComputePass(&descriptor);
+  compute_pass.SetPipeline(command.pipeline);
+  compute_pass.SetBindGroup(0, command.bind_group);
+  compute_pass.DispatchWorkgroups(command.x, command.y, command.z);
+  compute_pass.End();
+}
+
+void GPUProfiler::BeforeSubmit(wgpu::CommandEncoder& encoder) {
+  if (!timestamps_ || pending_.empty()) {
+    return;
+  }
+
+  // The query set and the resolve buffer are reused by the next submission.
+  // This is fine, since the queue executes the submissions in order.
+  const uint64_t size = 2 * pending_.size() * sizeof(uint64_t);
+  readback_buffer_ = gpu_.AcquireReadbackBuffer(size);
+  encoder.ResolveQuerySet(query_set_, 0, 2 * pending_.size(), resolve_buffer_,
+                          0);
+  encoder.CopyBufferToBuffer(resolve_buffer_, 0, readback_buffer_, 0, size);
+}
+
+void GPUProfiler::AfterSubmit() {
+  if (!timestamps_ || pending_.empty()) {
+    return;
+  }
+
+  struct Request {
+    GPUProfiler* profiler;
+    wgpu::Buffer buffer;
+    std::vector<Key> keys;
+  };
+  auto* request = new Request{
+      .profiler = this,
+      .buffer = readback_buffer_,
+      .keys = std::move(pending_),
+  };
+  pending_.clear();
+  readback_buffer_ = nullptr;
+  gpu_.BeginAsync();
+
+  const uint64_t size = 2 * request->keys.size() * sizeof(uint64_t);
+  request->buffer.MapAsync(
+      wgpu::MapMode::Read, 0, size,
+      [](WGPUBufferMapAsyncStatus status, void* userdata) {
+        std::unique_ptr<Request> request(reinterpret_cast<Request*>(userdata));
+        GPUProfiler& profiler = *request->profiler;
+        const uint64_t size = 2 * request->keys.size() * sizeof(uint64_t);
+        const auto* timestamps = reinterpret_cast<const uint64_t*>(
+            request->buffer.GetConstMappedRange(0, size));
+        if (status == WGPUBufferMapAsyncStatus_Success && timestamps) {
+          for (size_t i = 0; i < request->keys.size(); ++i) {
+            // The timestamps are in nanoseconds. They can go backward, when
+            // the GPU quantizes them.
+            const uint64_t begin = timestamps[2 * i];
+            const uint64_t end = std::max(begin, timestamps[2 * i + 1]);
+            profiler.Add(request->keys[i], (end - begin) * 1e-6);
+          }
+        }
+        request->buffer.Unmap();
+        profiler.gpu_.ReleaseReadbackBuffer(request->buffer);
+        profiler.gpu_.EndAsync();
+      },
+      reinterpret_cast<void*>(request));
+}
+
+void GPUProfiler::Add(const Key& key, double milliseconds) {
+  Entry& entry = entries_[key];
+  entry.node = std::get<0>(key);
+  entry.phase = std::get<1>(key);
+  entry.entry_point = std::get<2>(key);
+  entry.calls++;
+  entry.milliseconds += milliseconds;
+}
+
+bool GPUProfiler::WaitForQueue() {
+  struct Request {
+    GPU* gpu;
+    bool done = false;
+    bool success = false;
+  };
+  Request request{.gpu = &gpu_};
+  gpu_.BeginAsync();
+  gpu_.Device().GetQueue().OnSubmittedWorkDone(
+      [](WGPUQueueWorkDoneStatus status, void* userdata) {
+        Request& request = *reinterpret_cast<Request*>(userdata);
+        request.done = true;
+        request.success = status == WGPUQueueWorkDoneStatus_Success;
+        request.gpu->EndAsync();
+      },
+      reinterpret_cast<void*>(&request));
+
+  // Other operations may complete first.
+  while (!request.done) {
+    gpu_.WaitAny();
+  }
+  return request.success;
+}
+
+std::vector<GPUProfiler::Entry> GPUProfiler::Entries() const {
+  std::vector<Entry> entries;
+  for (const auto& [key, entry] : entries_) {
+    entries.push_back(entry);
+  }
+  std::stable_sort(entries.begin(), entries.end(),
+                   [](const Entry& a, const Entry& b) {
+                     return a.milliseconds > b.milliseconds;
+                   });
+  return entries;
+}
+
+std::string GPUProfiler::Table() const {
+  std::string out = fmt::format("GPU time, measured by the {}:\n",
+                                timestamps_ ? "GPU timestamps" : "CPU");
+  out += fmt::format("{:<24} {:<10} {:<28} {:>8} {:>12} {:>12}\n", "node",
+                     "phase", "entry point", "calls", "total (ms)",
+                     "mean (us)");
+  double total = 0.0;
+  for (const Entry& entry : Entries()) {
+    out += fmt::format("{:<24} {:<10} {:<28} {:>8} {:>12.3f} {:>12.1f}\n",
+                       entry.node.empty() ? "-" : entry.node,
+                       entry.phase.empty() ? "-" : entry.phase,
+                       entry.entry_point, entry.calls, entry.milliseconds,
+                       1000.0 * entry.milliseconds / entry.calls);
+    total += entry.milliseconds;
+  }
+  out += fmt::format("{:<73} {:>12.3f}\n", "total", total);
+  return out;
+}
+
+std::string GPUProfiler::Json() const {
+  std::string out = fmt::format("{{\"source\": \"{}\", \"entries\": [",
+                                timestamps_ ? "timestamps" : "cpu");
+  bool first = true;
+  for (const Entry& entry : Entries()) {
+    out += fmt::format(
+        "{}\n  {{\"node\": \"{}\", \"phase\": \"{}\", \"entry_point\": \"{}\", "
+        "\"calls\": {}, \"milliseconds\": {}}}",
+        first ? "" : ",", entry.node, entry.phase, entry.entry_point,
+        entry.calls, entry.milliseconds);
+    first = false;
+  }
+  out += "\n]}\n";
+  return out;
+}
+
+void GPUProfiler::Reset() {
+  entries_.clear();
+}
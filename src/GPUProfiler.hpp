@@ -0,0 +1,69 @@
+#ifndef GPU_PROFILER_HPP
+#define GPU_PROFILER_HPP
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "GPU.hpp"
+
+// Measures the GPU time of the dispatches, per node, phase and entry point.
+// Enabled by GPUOptions::profile, see GPU::Profiler(). The phase and the node
+// are set with GPU::SetProfileScope(), like Plan does.
+//
+// With the timestamp-query feature, every dispatch runs in its own compute
+// pass, whose beginning and end are timestamped. The timestamps are resolved
+// once per submission, and read back without blocking.
+//
+// Otherwise, every dispatch is submitted on its own, and the CPU blocks until
+// the queue reports it done. This is less precise, serializes the dispatches,
+// and stalls the recording.
+class GPUProfiler {
+ public:
+  explicit GPUProfiler(GPU& gpu, bool timestamps);
+  ~GPUProfiler();
+
+  // Whether the dispatches are timed by the GPU, rather than by the CPU.
+  bool Timestamps() const { return timestamps_; }
+
+  struct Entry {
+    std::string node;
+    std::string phase;
+    std::string entry_point;
+    int calls = 0;
+    double milliseconds = 0.0;
+  };
+  // The measures of the completed dispatches, by decreasing time. Call
+  // GPU::WaitAll() first, to include the ones in flight.
+  std::vector<Entry> Entries() const;
+  std::string Table() const;
+  std::string Json() const;
+  void Reset();
+
+  // Used by GPU:
+  void Dispatch(const GPUCommand& command);
+  void BeforeSubmit(wgpu::CommandEncoder& encoder);
+  void AfterSubmit();
+
+ private:
+  using Key = std::tuple<std::string, std::string, std::string>;
+  using Clock = std::chrono::steady_clock;
+  void Add(const Key& key, double milliseconds);
+  // Block until the submitted commands complete. Returns false if they
+  // failed, for instance when the device is lost.
+  bool WaitForQueue();
+
+  GPU& gpu_;
+  const bool timestamps_;
+  wgpu::QuerySet query_set_;
+  wgpu::Buffer resolve_buffer_;
+  wgpu::Buffer readback_buffer_;
+
+  // The dispatches timed in the commands not submitted yet.
+  std::vector<Key> pending_;
+
+  std::map<Key, Entry> entries_;
+};
+
+#endif  // GPU_PROFILER_HPP
@@ -0,0 +1,39 @@
+#include <span>
+#include <vector>
+#include "GPU.hpp"
+#include "GPUProfiler.hpp"
+#include "Node.hpp"
+#include "Predict.hpp"
+#include "gtest/gtest.h"
+
+TEST(GPUProfiler, Predict) {
+  GPU gpu(GPUOptions{.profile = true});
+  ASSERT_TRUE(gpu.Profiler());
+
+  Node input = Input(gpu, {3, 2}, /*training=*/false);
+  Node linear = Linear(input, {4});
+  Node output = Softmax(linear);
+
+  std::vector<float> example = {1.f, 2.f, 3.f};
+  Predict()
+      .Input(input, [&](int i) { return std::span(example); })
+      .Output(output)
+      .Size(6)
+      .Execute();
+  gpu.WaitAll();
+
+  // One dispatch per node and per batch.
+  const std::vector<GPUProfiler::Entry> entries = gpu.Profiler()->Entries();
+  ASSERT_EQ(entries.size(), 2);
+  for (const GPUProfiler::Entry& entry : entries) {
+    EXPECT_EQ(entry.phase, "forward");
+    EXPECT_EQ(entry.entry_point, "fn_output");
+    EXPECT_EQ(entry.calls, 3);
+    EXPECT_GE(entry.milliseconds, 0.0);
+  }
+  EXPECT_NE(gpu.Profiler()->Json().find("\"node\": \"Linear#1\""),
+            std::string::npos);
+
+  gpu.Profiler()->Reset();
+  EXPECT_TRUE(gpu.Profiler()->Entries().empty());
+}
@@ -0,0 +1,17 @@
+#include "Generator.hpp"
+#include <algorithm>
+#include <assert.hpp>
+
+BatchGenerator Batched(ExampleGenerator generator) {
+  return [generator = std::move(generator)](std::span<const int> indices,
+                                            std::span<float> batch) {
+    const size_t example_size = batch.size() / indices.size();
+    float* out = batch.data();
+    for (int index : indices) {
+      std::span<float> example = generator(index);
+      ASSERT(example.size() == example_size);
+      std::copy(example.begin(), example.end(), out);
+      out += example_size;
+    }
+  };
+}
@@ -0,0 +1,18 @@
+#ifndef GENERATOR_HPP
+#define GENERATOR_HPP
+
+#include <functional>
+#include <span>
+
+// Provide the data of a single example, given its index.
+using ExampleGenerator = std::function<std::span<float>(int index)>;
+
+// Fill `batch` with the data of the examples listed in `indices`, stored
+// contiguously one after the other.
+using BatchGenerator =
+    std::function<void(std::span<const int> indices, std::span<float> batch)>;
+
+// Build a BatchGenerator copying the examples one by one.
+BatchGenerator Batched(ExampleGenerator generator);
+
+#endif  // GENERATOR_HPP
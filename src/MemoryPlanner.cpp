@@ -0,0 +1,131 @@
+#include "MemoryPlanner.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace {
+
+// The minimum alignment of a storage buffer binding offset in WebGPU.
+constexpr uint64_t kAlignment = 256;
+
+uint64_t AlignUp(uint64_t size) {
+  return (size + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+struct Allocation {
+  Tensor* tensor;
+  int first;  // Index of the first command using the tensor.
+  int last;   // Index of the last command using the tensor.
+  uint64_t size;
+  uint64_t offset = 0;
+};
+
+// Compute the lifetime of every transient tensor.
+std::vector<Allocation> Lifetimes(const GPU& gpu,
+                                  const std::vector<GPUCommand>& commands,
+                                  const std::vector<Tensor*>& persistent) {
+  std::vector<Allocation> allocations;
+  std::unordered_map<Tensor*, int> index;  // Tensor -> allocation.
+  for (int i = 0; i < commands.size(); ++i) {
+    for (Tensor* tensor : commands[i].tensors) {
+      auto it = index.find(tensor);
+      if (it == index.end()) {
+        // Copies of a tensor share the same memory, hence the same allocation.
+        int allocation = -1;
+        for (int j = 0; j < allocations.size(); ++j) {
+          if (allocations[j].tensor->SameStorage(*tensor)) {
+            allocation = j;
+          }
+        }
+
+        const bool shareable =
+            tensor->Transient() &&
+            std::none_of(persistent.begin(), persistent.end(),
+                         [&](Tensor* p) { return p->SameStorage(*tensor); });
+        if (allocation == -1 && shareable) {
+          allocation = allocations.size();
+          allocations.push_back({
+              .tensor = tensor,
+              .first = i,
+              .last = i,
+              .size = AlignUp(tensor->ByteSize(gpu)),
+          });
+        }
+        it = index.insert({tensor, allocation}).first;
+      }
+
+      if (it->second != -1) {
+        allocations[it->second].last = i;
+      }
+    }
+  }
+  return allocations;
+}
+
+}  // namespace
+
+uint64_t PlanMemory(GPU& gpu,
+                    const std::vector<GPUCommand>& commands,
+                    const std::vector<Tensor*>& persistent) {
+  std::vector<Allocation> allocations = Lifetimes(gpu, commands, persistent);
+
+  // Place the largest tensors first, each one at the lowest offset not used
+  // by any tensor alive at the same time.
+  std::vector<Allocation*> order;
+  for (Allocation& allocation : allocations) {
+    order.push_back(&allocation);
+  }
+  std::stable_sort(order.begin(), order.end(), [](auto* a, auto* b) {
+    return a->size > b->size;
+  });
+
+  uint64_t total_size = 0;
+  std::vector<Allocation*> placed;
+  for (Allocation* allocation : order) {
+    std::vector<Allocation*> conflicts;
+    for (Allocation* other : placed) {
+      if (other->first <= allocation->last &&
+          allocation->first <= other->last) {
+        conflicts.push_back(other);
+      }
+    }
+    std::sort(conflicts.begin(), conflicts.end(),
+              [](auto* a, auto* b) { return a->offset < b->offset; });
+
+    uint64_t offset = 0;
+    for (Allocation* other : conflicts) {
+      if (offset + allocation->size <= other->offset) {
+        break;
+      }
+      offset = std::max(offset, other->offset + other->size);
+    }
+
+    allocation->offset = offset;
+    total_size = std::max(total_size, offset + allocation->size);
+    placed.push_back(allocation);
+  }
+
+  if (total_size == 0) {
+    return 0;
+  }
+
+  // Keep the tensors in their own buffers, when a single one can't fit them.
+  wgpu::SupportedLimits limits;
+  gpu.Device().GetLimits(&limits);
+  if (total_size > limits.limits.maxBufferSize) {
+    return 0;
+  }
+
+  wgpu::BufferDescriptor descriptor = {
+      .label = "Shared tensors",
+      .usage = wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopySrc |
+               wgpu::BufferUsage::CopyDst,
+      .size = total_size,
+      .mappedAtCreation = false,
+  };
+  wgpu::Buffer buffer = gpu.Device().CreateBuffer(&descriptor);
+  for (Allocation& allocation : allocations) {
+    allocation.tensor->Alias(buffer, allocation.offset);
+  }
+  return total_size;
+}
@@ -0,0 +1,22 @@
+#ifndef MEMORY_PLANNER_HPP
+#define MEMORY_PLANNER_HPP
+
+#include <vector>
+#include "GPU.hpp"
+#include "Tensor.hpp"
+
+// Share the memory of the transient tensors used by `commands`.
+//
+// The lifetime of a tensor spans from the first to the last command using it.
+// Tensors whose lifetimes don't overlap are assigned to the same memory, inside
+// a single shared buffer. The `persistent` tensors are left untouched.
+//
+// The bind groups referencing the moved tensors must be recreated, so the
+// commands need to be recorded again afterward.
+//
+// Returns the size of the shared buffer, in bytes.
+uint64_t PlanMemory(GPU& gpu,
+                    const std::vector<GPUCommand>& commands,
+                    const std::vector<Tensor*>& persistent);
+
+#endif  // MEMORY_PLANNER_HPP
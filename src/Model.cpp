@@ -1,11 +1,21 @@
 #include "Model.hpp"
+#include "DataLoader.hpp"
+#include "Trace.hpp"
 #include "fmt/format.h"
 
+namespace {
+constexpr int kMaxStepsInFlight = 2;
+}  // namespace
+
 Model::Model() = default;
 
-Model& Model::Input(Node input,
-                    std::function<std::span<float>(int)> generator) {
-  inputs_.push_back({input, generator});
+Model& Model::Input(Node input, ExampleGenerator generator) {
+  return Input(input, Batched(std::move(generator)));
+}
+
+Model& Model::Input(Node input, BatchGenerator generator) {
+  inputs_.push_back({input, std::move(generator)});
+  plan_ = {};
   return *this;
 }
 
@@ -16,6 +26,7 @@ Model& Model::Size(int size) {
 
 Model& Model::Minimize(Node output) {
   output_ = output;
+  plan_ = {};
   return *this;
 }
 
@@ -29,51 +40,91 @@ Model& Model::Epochs(int epochs) {
   return *this;
 }
 
+Model& Model::Workers(int workers) {
+  workers_ = workers;
+  return *this;
+}
+
+Model& Model::ShareMemory(bool share_memory) {
+  share_memory_ = share_memory;
+  plan_ = {};
+  return *this;
+}
+
+Model& Model::Shuffle(bool shuffle) {
+  shuffle_ = shuffle;
+  return *this;
+}
+
+Model& Model::OnLoss(std::function<void(float loss)> callback) {
+  on_loss_ = std::move(callback);
+  return *this;
+}
+
 void Model::Execute() {
+  TraceScope trace("model", "Model::Execute");
   NodePtr reference_node = inputs_[0].node.get();
   const int batch_size = reference_node->outputs[0].BatchSize();
   GPU& gpu = reference_node->gpu();
 
-  std::vector<NodePtr> backward_nodes =
-      NodeImpl::BackwardPassNodes(reference_node, output_.get());
-  std::vector<NodePtr> forward_nodes =
-      NodeImpl::ForwardPassNodes(reference_node, output_.get());
+  // Prepare the batches in the background:
+  DataLoader loader;
+  for (TrainInputArguments& input : inputs_) {
+    loader.Input(input.generator, input.node->outputs[0].TotalSize());
+  }
+  loader.Size(size_)
+      .BatchSize(batch_size)
+      .Batches((epochs_ * size_ + batch_size - 1) / batch_size)
+      .Workers(workers_)
+      .Shuffle(shuffle_)
+      .Start();
+
+  if (plan_.empty()) {
+    plan_ = Plan::Training(reference_node, output_.get());
+    if (share_memory_) {
+      plan_.ShareMemory(gpu);
+    }
+  }
+  NodeImpl::SetLearningRate(gpu, learning_rate_ / batch_size);
 
   for (int g = 0; g < epochs_ * size_; g += batch_size) {
+    TraceScope trace_step("model", "step");
+
     // Fill inputs:
-    for (TrainInputArguments& input : inputs_) {
-      for (int i = 0; i < batch_size; ++i) {
-        const int local_offset = (g + i) % size_;
-        input.node->outputs[0].WritePartialBatch(
-            gpu, input.generator(local_offset), i);
+    const DataLoader::Batch& batch = loader.Next();
+    {
+      TraceScope trace_upload("model", "upload");
+      for (int i = 0; i < inputs_.size(); ++i) {
+        inputs_[i].node->outputs[0].Write(gpu, batch.inputs[i]);
       }
     }
 
-    // Forward pass:
-    for (NodePtr node : forward_nodes) {
-      node->Forward();
+    // Forward pass, backward pass and parameters update, recorded into a
+    // single command buffer:
+    gpu.BeginStep();
+    plan_.Replay(gpu);
+    if (on_loss_) {
+      output_->outputs[0].ReadAsync(gpu, [&](std::span<const float> loss) {
+        TraceScope trace_readback("model", "readback");
+        float sum = 0.f;
+        for (float l : loss) {
+          sum += l;
+        }
+        on_loss_(sum / loss.size());
+      });
     }
-
-    // We want to minimize the loss.
-    output_->outputs[0].CopyTo(gpu, output_->outputs_gradients[0]);
-
-    //std::vector<float> loss = output_->outputs[0].Read(gpu);
-    //float sum = 0;
-    //for (float l : loss) {
-      //sum += l * l;
-    //}
-    //sum = sqrt(sum / loss.size());
-    //fmt::print("Loss: {}\n", sum);
-
-    // Backward pass:
-    for (NodePtr node : backward_nodes) {
-      node->Backward();
-      gpu.Instance().ProcessEvents();
+    {
+      TraceScope trace_submit("model", "submit");
+      gpu.EndStep();
     }
 
-    // Update parameters:
-    for (NodePtr node : backward_nodes) {
-      node->UpdateParameters(learning_rate_ / batch_size);
+    // Bound the number of loss readbacks in flight.
+    gpu.Poll();
+    while (gpu.PendingOperations() > kMaxStepsInFlight) {
+      gpu.WaitAny();
     }
   }
+  gpu.WaitAll();
+
+  loader_stats_ = loader.stats();
 }
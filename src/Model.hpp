@@ -4,31 +4,57 @@
 #include <functional>
 #include <span>
 #include <vector>
+#include "DataLoader.hpp"
+#include "Generator.hpp"
 #include "Node.hpp"
+#include "Plan.hpp"
 
 class Model {
  public:
    Model();
-   Model& Input(Node input, std::function<std::span<float>(int)> generator);
+   // Provide the examples one by one:
+   Model& Input(Node input, ExampleGenerator generator);
+   // Provide whole batches, uploaded at once:
+   Model& Input(Node input, BatchGenerator generator);
    Model& Size(int size);
    Model& Minimize(Node output);
    Model& LearningRate(float learning_rate);
    Model& Epochs(int epochs);
    Model& BatchSize(int batch_size);
+   // The number of threads calling the generators.
+   Model& Workers(int workers);
+   // Let the intermediate tensors not used at the same time share memory.
+   // Their values aren't kept after Execute(), except for the output's.
+   Model& ShareMemory(bool share_memory);
+   // Visit the examples in a different random order at every epoch.
+   Model& Shuffle(bool shuffle);
+
+   // Called with the mean of the output, for every batch. The values are read
+   // back asynchronously, without stalling the training.
+   Model& OnLoss(std::function<void(float loss)> callback);
+
+   // Statistics about the input pipeline of the last Execute().
+   const DataLoader::Stats& LoaderStats() const { return loader_stats_; }
 
    void Execute();
 
  private:
   struct TrainInputArguments {
     Node node;
-    std::function<std::span<float>(int)> generator;
+    BatchGenerator generator;
   };
 
   std::vector<TrainInputArguments> inputs_;
   Node output_;
+  Plan plan_;  // Built on the first Execute().
   float learning_rate_ = 0.01f;
   int epochs_ = 0;
   int size_ = 0;
+  int workers_ = 1;
+  bool share_memory_ = false;
+  bool shuffle_ = false;
+  std::function<void(float)> on_loss_;
+  DataLoader::Stats loader_stats_;
 };
 
 #endif  // MODEL_HPP
@@ -1,6 +1,7 @@
 #include "Node.hpp"
 
 #include <fmt/format.h>
+#include <algorithm>
 #include <queue>
 #include <unordered_set>
 #include <vector>
@@ -21,12 +22,21 @@ class UpdateParams {
   }
 
   UpdateParams(GPU& gpu) {
+    learning_rate.SetFullPrecision(true);
     learning_rate.Write(gpu, {0.01f});
 
+    // The scale starts high, and quickly halves until the gradients fit in
+    // f16. It is kept from one Model to the next.
+    if (gpu.HalfPrecision()) {
+      loss_scale.SetName("UpdateParams loss scale");
+      loss_scale.SetFullPrecision(true);
+      loss_scale.Write(gpu, {65536.f, 0.f, 0.f, 0.f});
+    }
+
     module = Shader(gpu, R"(
       @group(0) @binding(0) var<storage, read_write> learning_rate: f32;
-      @group(0) @binding(1) var<storage, read_write> weights: array<f32>;
-      @group(0) @binding(2) var<storage, read_write> weights_gradients: array<f32>;
+      @group(0) @binding(1) var<storage, read_write> weights: array<real>;
+      @group(0) @binding(2) var<storage, read_write> weights_gradients: array<real>;
       @group(0) @binding(3) var<storage, read_write> weights_gradients_squared_sum: array<f32>;
       @group(0) @binding(4) var<storage, read_write> weights_momentum: array<f32>;
 
@@ -35,13 +45,14 @@ class UpdateParams {
       const beta_2 = 0.99;
 
       @compute @workgroup_size(256, 1, 1)
-      fn main(@builtin(global_invocation_id) global_id: vec3<u32>) {
-        let x = global_id.x;
-        if (x >= arrayLength(&weights)) {
+      fn main(@builtin(global_invocation_id) global_id: vec3<u32>,
+              @builtin(num_workgroups) num_workgroups: vec3<u32>) {
+        let x = flat_index(global_id, num_workgroups, 256);
+        if (x >= arrayLength(&weights_momentum)) {
           return;
         }
 
-        let gradient = weights_gradients[x];
+        let gradient = f32(weights_gradients[x]);
         weights_gradients_squared_sum[x] = mix(
           gradient * gradient,
           weights_gradients_squared_sum[x],
@@ -54,20 +65,408 @@ class UpdateParams {
           beta_1
         );
 
-        weights[x] -= learning_rate * weights_momentum[x] / (
+        weights[x] = real(f32(weights[x]) -
+          learning_rate * weights_momentum[x] / (
+            sqrt(weights_gradients_squared_sum[x]) +
+            epsilon
+          )
+        );
+      }
+    )");
+
+    // Mixed precision: the f16 weights are rounded from an f32 master copy,
+    // and the gradients are scaled by the loss scale. The step is skipped
+    // when a gradient overflows.
+    mixed_precision_module = Shader(gpu, std::string(kLossScale) + R"(
+      @group(0) @binding(0) var<storage, read_write> learning_rate: f32;
+      @group(0) @binding(1) var<storage, read_write> weights: array<real>;
+      @group(0) @binding(2) var<storage, read_write> weights_gradients: array<real>;
+      @group(0) @binding(3) var<storage, read_write> weights_gradients_squared_sum: array<f32>;
+      @group(0) @binding(4) var<storage, read_write> weights_momentum: array<f32>;
+      @group(0) @binding(5) var<storage, read_write> master_weights: array<f32>;
+      @group(0) @binding(6) var<storage, read_write> loss_scale: LossScale;
+
+      const epsilon: f32 = 1e-8;
+      const beta_1 = 0.9;
+      const beta_2 = 0.99;
+
+      @compute @workgroup_size(256, 1, 1)
+      fn fn_init_master(@builtin(global_invocation_id) id: vec3<u32>,
+                        @builtin(num_workgroups) num_workgroups: vec3<u32>) {
+        let x = flat_index(id, num_workgroups, 256);
+        if (x >= arrayLength(&master_weights)) {
+          return;
+        }
+        master_weights[x] = f32(weights[x]);
+      }
+
+      // Infinity and NaN have all their exponent bits set.
+      fn is_finite(value: f32) -> bool {
+        return (bitcast<u32>(value) & 0x7f800000u) != 0x7f800000u;
+      }
+
+      @compute @workgroup_size(256, 1, 1)
+      fn fn_check_gradients(@builtin(global_invocation_id) id: vec3<u32>,
+                            @builtin(num_workgroups) num_workgroups: vec3<u32>) {
+        let x = flat_index(id, num_workgroups, 256);
+        if (x >= arrayLength(&master_weights)) {
+          return;
+        }
+        if (!is_finite(f32(weights_gradients[x]))) {
+          atomicStore(&loss_scale.overflow, 1u);
+        }
+      }
+
+      @compute @workgroup_size(256, 1, 1)
+      fn fn_update(@builtin(global_invocation_id) id: vec3<u32>,
+                   @builtin(num_workgroups) num_workgroups: vec3<u32>) {
+        let x = flat_index(id, num_workgroups, 256);
+        if (x >= arrayLength(&master_weights)) {
+          return;
+        }
+        if (atomicLoad(&loss_scale.overflow) != 0u) {
+          return;
+        }
+
+        let gradient = f32(weights_gradients[x]) / loss_scale.scale;
+        weights_gradients_squared_sum[x] = mix(
+          gradient * gradient,
+          weights_gradients_squared_sum[x],
+          beta_2
+        );
+
+        weights_momentum[x] = mix(
+          gradient,
+          weights_momentum[x],
+          beta_1
+        );
+
+        master_weights[x] -= learning_rate * weights_momentum[x] / (
           sqrt(weights_gradients_squared_sum[x]) +
           epsilon
         );
+        weights[x] = real(master_weights[x]);
+      }
+    )");
+
+    loss_scale_module = Shader(gpu, std::string(kLossScale) + R"(
+      @group(0) @binding(0) var<storage, read_write> loss_scale: LossScale;
+      @group(0) @binding(1) var<storage, read_write> loss: array<real>;
+      @group(0) @binding(2) var<storage, read_write> loss_gradient: array<real>;
+
+      // The scale grows after this many steps without overflow.
+      const growth_interval = 2000u;
+      const max_scale = 16777216.0;
+
+      // Seed the backward pass with the scaled loss.
+      @compute @workgroup_size(256, 1, 1)
+      fn fn_seed(@builtin(global_invocation_id) id: vec3<u32>,
+                 @builtin(num_workgroups) num_workgroups: vec3<u32>) {
+        let x = flat_index(id, num_workgroups, 256);
+        if (x >= arrayLength(&loss)) {
+          return;
+        }
+        loss_gradient[x] = real(f32(loss[x]) * loss_scale.scale);
+      }
+
+      @compute @workgroup_size(1, 1, 1)
+      fn fn_update_scale() {
+        if (atomicLoad(&loss_scale.overflow) != 0u) {
+          loss_scale.scale = max(loss_scale.scale * 0.5, 1.0);
+          loss_scale.good_steps = 0u;
+          atomicStore(&loss_scale.overflow, 0u);
+          return;
+        }
+
+        loss_scale.good_steps++;
+        if (loss_scale.good_steps >= growth_interval) {
+          loss_scale.scale = min(loss_scale.scale * 2.0, max_scale);
+          loss_scale.good_steps = 0u;
+        }
       }
     )");
   }
 
+  // The state of the dynamic loss scaling, see FusedOptimizer.
+  static constexpr const char* kLossScale = R"(
+    struct LossScale {
+      scale: f32,
+      good_steps: u32,
+      overflow: atomic<u32>,
+      padding: u32,
+    }
+  )";
+
   wgpu::ShaderModule module;
+  wgpu::ShaderModule mixed_precision_module;
+  wgpu::ShaderModule loss_scale_module;
   Tensor learning_rate{{1}};
+  Tensor loss_scale{{4}};  // {scale, good_steps, overflow, padding}
+};
+
+namespace {
+
+// Parameters are packed at offsets aligned on minStorageBufferOffsetAlignment,
+// in values. Their f16 values and their f32 state share the same offsets.
+constexpr uint64_t kAlignment = 256 / sizeof(uint16_t);
+uint64_t AlignUp(uint64_t size) {
+  return (size + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+}  // namespace
+
+struct ParameterGroup {
+  ParameterGroup(GPU& gpu, int size)
+      : weights({size}),
+        weights_gradients({size}),
+        weights_gradients_squared_sum({size}),
+        weights_momentum({size}),
+        master_weights({size}),
+        pipeline(gpu) {
+    weights_gradients_squared_sum.SetFullPrecision(true);
+    weights_momentum.SetFullPrecision(true);
+    master_weights.SetFullPrecision(true);
+  }
+
+  Tensor weights;
+  Tensor weights_gradients;
+  Tensor weights_gradients_squared_sum;
+  Tensor weights_momentum;
+  Tensor master_weights;  // Mixed precision only.
+  NodePipeline pipeline;
+
+  // The parameters packed here. The slot of a parameter moved to another
+  // group is left unused, with a zero gradient.
+  std::vector<std::pair<NodePtr, int>> members;
 };
 
+FusedOptimizer::FusedOptimizer(GPU& gpu, const std::vector<NodePtr>& nodes)
+    : gpu_(gpu),
+      update_params_(UpdateParams::Get(gpu)),
+      mixed_precision_(gpu.HalfPrecision()),
+      loss_scale_pipeline_(gpu) {
+  for (NodePtr node : nodes) {
+    if (node->training() && !node->weights.empty()) {
+      nodes_.push_back(node);
+      node->weights_group.resize(node->weights.size());
+    }
+  }
+  if (mixed_precision_) {
+    loss_scale_pipeline_.Init(update_params_->loss_scale_module,
+                              {&update_params_->loss_scale});
+  }
+
+  // The groups of a previous optimizer are reused, unless they also hold
+  // parameters this one doesn't update.
+  const std::unordered_set<NodePtr> owned(nodes_.begin(), nodes_.end());
+  auto reusable = [&](const ParameterGroup& group) {
+    return std::all_of(group.members.begin(), group.members.end(),
+                       [&](const auto& member) {
+                         return owned.count(member.first) == 1;
+                       });
+  };
+
+  wgpu::SupportedLimits limits;
+  gpu.Device().GetLimits(&limits);
+  const uint64_t max_group_size =
+      limits.limits.maxStorageBufferBindingSize / sizeof(float);
+
+  // Give every other parameter an offset in a new group. A group must fit in
+  // a single storage buffer binding.
+  struct Slot {
+    NodePtr node;
+    int index;
+    int group;
+    uint64_t offset;
+  };
+  std::vector<Slot> slots;
+  std::vector<uint64_t> group_sizes;
+  for (NodePtr node : nodes_) {
+    for (int i = 0; i < node->weights.size(); ++i) {
+      if (node->weights_group[i] && reusable(*node->weights_group[i])) {
+        continue;
+      }
+      const uint64_t size = AlignUp(node->weights[i].TotalSize());
+      if (group_sizes.empty() || group_sizes.back() + size > max_group_size) {
+        group_sizes.push_back(0);
+      }
+      slots.push_back({
+          .node = node,
+          .index = i,
+          .group = int(group_sizes.size()) - 1,
+          .offset = group_sizes.back(),
+      });
+      group_sizes.back() += size;
+    }
+  }
+
+  // The padding between the parameters is zero, and stays zero.
+  std::vector<std::shared_ptr<ParameterGroup>> groups;
+  for (uint64_t size : group_sizes) {
+    groups.push_back(std::make_shared<ParameterGroup>(gpu, size));
+    ParameterGroup& group = *groups.back();
+    group.weights.Fill(gpu, 0.f);
+    group.weights_gradients.Fill(gpu, 0.f);
+    group.weights_gradients_squared_sum.Fill(gpu, 0.f);
+    group.weights_momentum.Fill(gpu, 0.f);
+    if (!mixed_precision_) {
+      group.pipeline.Init(update_params_->module,
+                          {
+                              &update_params_->learning_rate,
+                              &group.weights,
+                              &group.weights_gradients,
+                              &group.weights_gradients_squared_sum,
+                              &group.weights_momentum,
+                          });
+      continue;
+    }
+    group.master_weights.Fill(gpu, 0.f);
+    group.pipeline.Init(update_params_->mixed_precision_module,
+                        {
+                            &update_params_->learning_rate,
+                            &group.weights,
+                            &group.weights_gradients,
+                            &group.weights_gradients_squared_sum,
+                            &group.weights_momentum,
+                            &group.master_weights,
+                            &update_params_->loss_scale,
+                        });
+  }
+
+  // Move the parameters and their state into the groups, keeping their
+  // values. Every node pipeline rebinds to the new memory on its next run,
+  // and the plans using them capture their commands again.
+  for (const Slot& slot : slots) {
+    ParameterGroup& group = *groups[slot.group];
+    auto move = [&](Tensor& tensor, Tensor& packed) {
+      const uint64_t offset = slot.offset * tensor.ElementSize(gpu);
+      Tensor destination(tensor.sizes());
+      destination.SetFullPrecision(!tensor.Half(gpu));
+      destination.Alias(packed.Buffer(), offset);
+      destination.CopyFrom(gpu, tensor);
+      tensor.Alias(packed.Buffer(), offset);
+    };
+    NodePtr node = slot.node;
+    Tensor& gradients = node->weights_gradients[slot.index];
+    Tensor previous_gradients(gradients.sizes());
+    previous_gradients.SetFullPrecision(!gradients.Half(gpu));
+    previous_gradients.Alias(gradients.Buffer(), gradients.Offset());
+
+    move(node->weights[slot.index], group.weights);
+    move(gradients, group.weights_gradients);
+    move(node->weights_gradients_squared_sum[slot.index],
+         group.weights_gradients_squared_sum);
+    move(node->weights_momentum[slot.index], group.weights_momentum);
+
+    std::shared_ptr<ParameterGroup>& previous = node->weights_group[slot.index];
+    if (previous) {
+      // The other optimizers of the previous group keep updating the unused
+      // slot, which must not overflow.
+      previous_gradients.Fill(gpu, 0.f);
+      std::erase(previous->members, std::make_pair(node, slot.index));
+    }
+    previous = groups[slot.group];
+    group.members.emplace_back(node, slot.index);
+  }
+
+  if (!mixed_precision_) {
+    return;
+  }
+
+  // The master weights are derived from the weights the first time only.
+  // Afterwards, they are moved like the rest of the state, since the weights
+  // lost their low bits to f16.
+  for (auto& group : groups) {
+    RunGroup(*group, "fn_init_master");
+  }
+  for (const Slot& slot : slots) {
+    ParameterGroup& group = *groups[slot.group];
+    Tensor& master = slot.node->weights_master[slot.index];
+    const uint64_t offset = slot.offset * sizeof(float);
+    if (master.Buffer()) {
+      Tensor destination(master.sizes());
+      destination.SetFullPrecision(true);
+      destination.Alias(group.master_weights.Buffer(), offset);
+      destination.CopyFrom(gpu, master);
+    }
+    master.Alias(group.master_weights.Buffer(), offset);
+  }
+}
+
+FusedOptimizer::~FusedOptimizer() = default;
+
+void FusedOptimizer::SeedGradient(Tensor& loss, Tensor& loss_gradient) {
+  if (!mixed_precision_) {
+    loss.CopyTo(gpu_, loss_gradient);
+    return;
+  }
+
+  // The loss is only known here. Init() is cheap when the plan is captured
+  // again.
+  loss_scale_pipeline_.Init(update_params_->loss_scale_module,
+                            {
+                                &update_params_->loss_scale,
+                                &loss,
+                                &loss_gradient,
+                            });
+  loss_scale_pipeline_.RunFlat("fn_seed", loss.TotalSize(), 256);
+}
+
+void FusedOptimizer::UpdateParameters() {
+  const std::vector<ParameterGroup*> groups = Groups();
+  if (!mixed_precision_) {
+    for (ParameterGroup* group : groups) {
+      RunGroup(*group, "main");
+    }
+    return;
+  }
+
+  // Every group must be checked before any of them is updated, since the
+  // whole step is skipped when one gradient overflows.
+  for (ParameterGroup* group : groups) {
+    RunGroup(*group, "fn_check_gradients");
+  }
+  for (ParameterGroup* group : groups) {
+    RunGroup(*group, "fn_update");
+  }
+  loss_scale_pipeline_.Run("fn_update_scale", 1);
+}
+
+float FusedOptimizer::LossScale() {
+  if (!mixed_precision_) {
+    return 1.f;
+  }
+  return update_params_->loss_scale.Read(gpu_)[0];
+}
+
+std::vector<ParameterGroup*> FusedOptimizer::Groups() {
+  std::vector<ParameterGroup*> groups;
+  for (NodePtr node : nodes_) {
+    for (auto& group : node->weights_group) {
+      if (std::find(groups.begin(), groups.end(), group.get()) ==
+          groups.end()) {
+        groups.push_back(group.get());
+      }
+    }
+  }
+  return groups;
+}
+
+void FusedOptimizer::RunGroup(ParameterGroup& group,
+                              const std::string& entrypoint) {
+  group.pipeline.RunFlat(entrypoint, group.weights.TotalSize(), 256);
+}
+
 NodeImpl::NodeImpl(GPU& gpu) : gpu_(gpu) {}
 
+NodeImpl::~NodeImpl() {
+  for (int i = 0; i < weights_group.size(); ++i) {
+    if (weights_group[i]) {
+      std::erase(weights_group[i]->members, std::make_pair(NodePtr(this), i));
+    }
+  }
+}
+
 NodeImpl::NodeImpl(Node& input) : NodeImpl(input->gpu()) {
   AddNode(input);
 }
@@ -78,6 +477,7 @@ NodeImpl::NodeImpl(Node& input_a, Node& input_b): NodeImpl(input_a->gpu()) {
 }
 
 void NodeImpl::AddNode(Node& input) {
+  training_ = training_ && input->training_;
   input_nodes.push_back(input);
   input->output_nodes.push_back(this);
 }
@@ -133,28 +533,57 @@ std::vector<NodePtr> NodeImpl::BackwardPassNodes(NodePtr input,
 }
 
 void NodeImpl::UpdateParameters(float learning_rate) {
-  for (int i = 0; i < weights.size(); ++i) {
-    update_params_->learning_rate.Write(gpu(), {learning_rate});
-    pipeline_[i].Run("main", (weights[i].TotalSize() + 255) / 256);
+  SetLearningRate(gpu(), learning_rate);
+  UpdateParameters();
+}
+
+void NodeImpl::UpdateParameters() {
+  for (int i = 0; i < pipeline_.size(); ++i) {
+    pipeline_[i].RunFlat("main", weights[i].TotalSize(), 256);
   }
 }
 
-void NodeImpl::SetupGradients() {
-  update_params_ = UpdateParams::Get(gpu());
-  wgpu::ShaderModule module = update_params_->module;
+// static
+void NodeImpl::SetLearningRate(GPU& gpu, float learning_rate) {
+  UpdateParams::Get(gpu)->learning_rate.Write(gpu, {learning_rate});
+}
 
+void NodeImpl::SetupGradients() {
+  // Inference-only nodes keep the gradient tensors, so that the node's
+  // pipelines can still refer to them, but never allocate their memory. Their
+  // bindings are left out, see NodePipeline.
   for (Tensor& parameter : weights) {
     weights_gradients.push_back(Tensor(parameter.sizes()));
-    weights_gradients.back().Fill(gpu(), 0.f);
-
     weights_gradients_squared_sum.push_back(Tensor(parameter.sizes()));
-    weights_gradients_squared_sum.back().Fill(gpu(), 1.f);
-
     weights_momentum.push_back(Tensor(parameter.sizes()));
-    weights_momentum.back().Fill(gpu(), 0.f);
+    weights_master.push_back(Tensor(parameter.sizes()));
+    // The optimizer state holds small values, out of the range of f16.
+    weights_gradients_squared_sum.back().SetFullPrecision(true);
+    weights_momentum.back().SetFullPrecision(true);
+    weights_master.back().SetFullPrecision(true);
+  }
+
+  for (Tensor& output : outputs) {
+    outputs_gradients.push_back(Tensor(output.sizes()));
+  }
+
+  // Outputs are recomputed at every step.
+  for (Tensor& output : outputs) {
+    output.SetTransient(true);
+  }
+
+  if (!training_) {
+    return;
   }
 
+  update_params_ = UpdateParams::Get(gpu());
+  wgpu::ShaderModule module = update_params_->module;
+
   for (int i = 0; i < weights.size(); ++i) {
+    weights_gradients[i].Fill(gpu(), 0.f);
+    weights_gradients_squared_sum[i].Fill(gpu(), 1.f);
+    weights_momentum[i].Fill(gpu(), 0.f);
+
     pipeline_.emplace_back(gpu());
     pipeline_.back().Init(module, {
                                       &update_params_->learning_rate,
@@ -165,9 +594,10 @@ void NodeImpl::SetupGradients() {
                                   });
   }
 
-  for (Tensor& output : outputs) {
-    outputs_gradients.push_back(Tensor(output.sizes()));
-    outputs_gradients.back().Fill(gpu(), 0.f);
+  // Output gradients are recomputed at every step.
+  for (Tensor& output_gradient : outputs_gradients) {
+    output_gradient.Fill(gpu(), 0.f);
+    output_gradient.SetTransient(true);
   }
 }
 
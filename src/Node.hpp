@@ -17,7 +17,10 @@ Node Conv2DTranspose(Node input, int channels, int kernel_size, int stride = 1);
 Node CrossEntropy(Node a, Node b);
 Node Difference(Node a, Node b);
 Node HuberLoss(Node input);
-Node Input(GPU& gpu, std::vector<int> sizes);
+// Nodes built on top of an input created with `training = false` are
+// inference-only: they don't allocate gradients or optimizer state, and can
+// only be used for the forward pass. See Predict.
+Node Input(GPU& gpu, std::vector<int> sizes, bool training = true);
 Node LeakyReLU(Node input);
 Node Linear(Node input, std::vector<int> output_size);
 Node MaxPool2D(Node input, int kernel_size);
@@ -28,6 +31,7 @@ Node Squared(Node input);
 Node Interpolation2D(Node input, int width, int height);
 
 class UpdateParams;
+struct ParameterGroup;
 
 class NodeImpl {
  public:
@@ -35,21 +39,45 @@ class NodeImpl {
   NodeImpl(Node& input);
   NodeImpl(Node& input_a, Node& input_b);
 
-  virtual ~NodeImpl() = default;
+  virtual ~NodeImpl();
 
   std::vector<Tensor> weights;
   std::vector<Tensor> weights_gradients;
   std::vector<Tensor> weights_gradients_squared_sum;
   std::vector<Tensor> weights_momentum;
+  // Mixed precision only: the f32 weights the f16 ones are rounded from. Their
+  // memory is set by FusedOptimizer.
+  std::vector<Tensor> weights_master;
+  // The FusedOptimizer group each parameter and its state are packed into,
+  // reused by the next optimizers. Null until packed.
+  std::vector<std::shared_ptr<ParameterGroup>> weights_group;
 
   std::vector<Tensor> outputs;
   std::vector<Tensor> outputs_gradients;
 
   virtual void Forward() {}
+  // The forward pass of Plan::Inference. Nodes behaving differently outside
+  // of training, like BatchNormalization, override it.
+  virtual void ForwardInference() { Forward(); }
+  // Compute the values reused by every ForwardInference(), when they only
+  // depend on the parameters. Issued outside of the plan's capture, once per
+  // Predict::Execute(). See Plan::Prepare().
+  virtual void PrepareInference() {}
+  // Post-training int8 quantization of the inference, see Predict::Quantize().
+  // Only implemented by Linear and Conv2D. StartCalibration() makes the next
+  // inference passes measure the range of the node's input, and Quantize()
+  // converts the weights to int8 for the following ones.
+  virtual void StartCalibration() {}
+  virtual void Quantize() {}
   virtual void Backward() {}
   virtual std::string Name() { return "Node"; }
   void UpdateParameters(float learning_rate);
 
+  // Apply one optimizer step, using the learning rate previously set with
+  // SetLearningRate(). The learning rate is shared by every node of the GPU.
+  void UpdateParameters();
+  static void SetLearningRate(GPU& gpu, float learning_rate);
+
   // A topology-sorted list of nodes to be used in the forward/backward pass.
   // The forward pass starts from the input node and ends at the output node.
   // The backward pass starts from the output node and ends at the input node.
@@ -58,8 +86,13 @@ class NodeImpl {
 
   GPU& gpu() { return gpu_; }
 
+  // Whether the node supports the backward pass. A node is trainable only
+  // when all of its inputs are.
+  bool training() const { return training_; }
+
  protected:
   void SetupGradients();
+  bool training_ = true;
 
  private:
   void AddNode(Node& input);
@@ -79,4 +112,50 @@ class NodeImpl {
   std::vector<NodePtr> output_nodes;
 };
 
+// Applies the optimizer step of NodeImpl::UpdateParameters() to every
+// parameter of `nodes` at once.
+//
+// The parameters and their optimizer state are moved into a few large
+// buffers, sharing the same layout, so that the whole update takes one
+// dispatch per buffer instead of one per tensor.
+//
+// The packing is done once per graph: the next optimizers over the same
+// parameters reuse the groups, so that every Model and Predict sees the same
+// memory. A group is always updated as a whole, so an optimizer only reuses
+// the groups holding none of the parameters it doesn't own, and moves its
+// parameters out of the others.
+//
+// On half precision GPUs, the training is mixed precision: the optimizer
+// keeps an f32 master copy of the weights, and the f16 ones are rounded from
+// it. The gradients are computed for the loss multiplied by a dynamic scale,
+// so that they don't underflow in f16. A step with an overflowing gradient is
+// skipped and halves the scale. This is all decided on the GPU.
+class FusedOptimizer {
+ public:
+  FusedOptimizer(GPU& gpu, const std::vector<NodePtr>& nodes);
+  ~FusedOptimizer();
+
+  // Starts the backward pass, minimizing `loss`.
+  void SeedGradient(Tensor& loss, Tensor& loss_gradient);
+  void UpdateParameters();
+
+  // The current loss scale. Blocks on the GPU. Used for testing.
+  float LossScale();
+
+ private:
+  // The groups currently holding the parameters of `nodes_`. Another
+  // optimizer can move some of them to new groups.
+  std::vector<ParameterGroup*> Groups();
+  void RunGroup(ParameterGroup& group, const std::string& entrypoint);
+
+  GPU& gpu_;
+  std::shared_ptr<UpdateParams> update_params_;
+  std::vector<NodePtr> nodes_;  // The nodes with parameters to update.
+
+  // Mixed precision. The loss scale and the master weights outlive the
+  // optimizer, in UpdateParams and in the nodes.
+  bool mixed_precision_ = false;
+  NodePipeline loss_scale_pipeline_;
+};
+
 #endif
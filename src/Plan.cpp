@@ -0,0 +1,159 @@
+#include "Plan.hpp"
+#include "MemoryPlanner.hpp"
+#include <assert.hpp>
+#include <map>
+#include <optional>
+#include "Trace.hpp"
+#include "fmt/format.h"
+
+namespace {
+
+// The names of the nodes in the profiler. Unique within the plan.
+std::map<NodePtr, std::string> ProfileNames(
+    const std::vector<NodePtr>& forward_nodes) {
+  std::map<NodePtr, std::string> names;
+  for (size_t i = 0; i < forward_nodes.size(); ++i) {
+    names[forward_nodes[i]] =
+        fmt::format("{}#{}", forward_nodes[i]->Name(), i);
+  }
+  return names;
+}
+
+}  // namespace
+
+// static
+Plan Plan::Inference(NodePtr input, NodePtr output) {
+  Plan plan;
+  std::vector<NodePtr> forward_nodes =
+      NodeImpl::ForwardPassNodes(input, output);
+  plan.record_ = [forward_nodes, names = ProfileNames(forward_nodes),
+                  &gpu = input->gpu()] {
+    for (NodePtr node : forward_nodes) {
+      gpu.SetProfileScope(names.at(node), "forward");
+      node->ForwardInference();
+    }
+    gpu.SetProfileScope("", "");
+  };
+  plan.prepare_ = [forward_nodes, names = ProfileNames(forward_nodes),
+                   &gpu = input->gpu()] {
+    for (NodePtr node : forward_nodes) {
+      gpu.SetProfileScope(names.at(node), "prepare");
+      node->PrepareInference();
+    }
+    gpu.SetProfileScope("", "");
+  };
+  plan.persistent_ = {&output->outputs[0]};
+  plan.Capture(input->gpu());
+  return plan;
+}
+
+// static
+Plan Plan::Training(NodePtr input, NodePtr output) {
+  // Inference-only graphs have no gradients to train with.
+  ASSERT(output->training());
+  Plan plan;
+  std::vector<NodePtr> forward_nodes =
+      NodeImpl::ForwardPassNodes(input, output);
+  std::vector<NodePtr> backward_nodes =
+      NodeImpl::BackwardPassNodes(input, output);
+  auto optimizer =
+      std::make_shared<FusedOptimizer>(input->gpu(), backward_nodes);
+  plan.record_ = [forward_nodes, backward_nodes, optimizer, output,
+                  names = ProfileNames(forward_nodes), &gpu = input->gpu()] {
+    for (NodePtr node : forward_nodes) {
+      gpu.SetProfileScope(names.at(node), "forward");
+      node->Forward();
+    }
+
+    // We want to minimize the output.
+    gpu.SetProfileScope(names.at(output), "backward");
+    optimizer->SeedGradient(output->outputs[0], output->outputs_gradients[0]);
+
+    for (NodePtr node : backward_nodes) {
+      gpu.SetProfileScope(names.at(node), "backward");
+      node->Backward();
+    }
+
+    gpu.SetProfileScope("FusedOptimizer", "optimizer");
+    optimizer->UpdateParameters();
+    gpu.SetProfileScope("", "");
+  };
+  plan.persistent_ = {&output->outputs[0]};
+  plan.Capture(input->gpu());
+  return plan;
+}
+
+void Plan::Replay(GPU& gpu) {
+  if (StorageChanged()) {
+    if (share_memory_) {
+      ShareMemory(gpu);
+    } else {
+      Capture(gpu);
+    }
+  }
+
+  if (!Trace::Enabled()) {
+    for (const GPUCommand& command : commands_) {
+      gpu.Record(command);
+    }
+    return;
+  }
+
+  // One trace event per run of consecutive commands of the same node and
+  // phase. The commands without a node, like copies, extend the current one.
+  std::optional<TraceScope> scope;
+  const GPUCommand* scope_command = nullptr;
+  for (const GPUCommand& command : commands_) {
+    if (!command.node.empty() &&
+        (!scope_command || command.node != scope_command->node ||
+         command.phase != scope_command->phase)) {
+      scope.reset();
+      scope.emplace("record", command.node + " " + command.phase);
+      scope_command = &command;
+    }
+    gpu.Record(command);
+  }
+}
+
+void Plan::Prepare() const {
+  if (prepare_) {
+    prepare_();
+  }
+}
+
+uint64_t Plan::ShareMemory(GPU& gpu) {
+  const uint64_t size = PlanMemory(gpu, commands_, persistent_);
+  share_memory_ = true;
+
+  // Capture again, so that the commands use the tensors' new memory.
+  Capture(gpu);
+  return size;
+}
+
+void Plan::Capture(GPU& gpu) {
+  commands_.clear();
+  gpu.BeginCapture(&commands_);
+  record_();
+  gpu.EndCapture();
+
+  storage_.clear();
+  for (GPUCommand& command : commands_) {
+    for (Tensor* tensor : command.tensors) {
+      storage_.emplace_back(tensor->Buffer(), tensor->Offset());
+    }
+  }
+}
+
+bool Plan::StorageChanged() {
+  auto storage = storage_.begin();
+  for (GPUCommand& command : commands_) {
+    for (Tensor* tensor : command.tensors) {
+      if (storage->first.Get() != tensor->Buffer().Get() ||
+          storage->second != tensor->Offset()) {
+        return true;
+      }
+      ++storage;
+    }
+  }
+  return false;
+}
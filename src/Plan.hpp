@@ -0,0 +1,60 @@
+#ifndef PLAN_HPP
+#define PLAN_HPP
+
+#include <functional>
+#include <vector>
+#include "GPU.hpp"
+#include "Node.hpp"
+
+// A precompiled list of GPU commands, replayed at every step of Model and
+// Predict.
+//
+// It is built once from the graph, by capturing the commands issued by the
+// Forward() and Backward() of every node, in topological order, followed by a
+// FusedOptimizer step. Each command has its pipeline, bind group and dispatch
+// size already resolved, so replaying involves no allocation and no pipeline
+// lookup.
+class Plan {
+ public:
+  Plan() = default;
+
+  // The forward pass, from `input` to `output`.
+  static Plan Inference(NodePtr input, NodePtr output);
+
+  // The forward pass, the backward pass minimizing `output`, and the update of
+  // the parameters. The learning rate is read from NodeImpl::SetLearningRate.
+  static Plan Training(NodePtr input, NodePtr output);
+
+  // Record the commands into the current step of the GPU. When a tensor was
+  // moved since the capture, for instance by the ShareMemory() of another
+  // plan of the same graph, the commands are captured again first. A plan
+  // sharing memory plans it again too: the other plan's layout follows the
+  // lifetimes of its own commands.
+  void Replay(GPU& gpu);
+
+  // Compute the values every replay of an inference plan reuses, like the
+  // transformed weights of Conv2D. Not captured: call it again whenever the
+  // parameters change. See NodeImpl::PrepareInference().
+  void Prepare() const;
+
+  // Let the tensors not used at the same time during the plan share the same
+  // memory. See PlanMemory(). Returns the size of the shared memory, in bytes.
+  uint64_t ShareMemory(GPU& gpu);
+
+  bool empty() const { return commands_.empty(); }
+
+ private:
+  void Capture(GPU& gpu);
+  bool StorageChanged();
+
+  std::function<void()> record_;   // Issue the commands of the plan.
+  std::function<void()> prepare_;  // Issue the commands of Prepare().
+  std::vector<Tensor*> persistent_;  // Tensors read after the plan.
+  std::vector<GPUCommand> commands_;
+  bool share_memory_ = false;
+
+  // The buffer and offset of every GPUCommand::tensors, at capture time.
+  std::vector<std::pair<wgpu::Buffer, uint64_t>> storage_;
+};
+
+#endif  // PLAN_HPP
@@ -1,18 +1,29 @@
 #include "Predict.hpp"
+#include "DataLoader.hpp"
+#include "Trace.hpp"
 #include <assert.hpp>
 #include <iostream>
 #include <fmt/format.h>
 
+namespace {
+constexpr int kMaxBatchesInFlight = 2;
+}  // namespace
+
 Predict::Predict() {}
 
-Predict& Predict::Input(Node input,
-                        std::function<std::span<float>(int)> generator) {
-  inputs_.push_back({input, generator});
+Predict& Predict::Input(Node input, ExampleGenerator generator) {
+  return Input(input, Batched(std::move(generator)));
+}
+
+Predict& Predict::Input(Node input, BatchGenerator generator) {
+  inputs_.push_back({input, std::move(generator)});
+  plan_ = {};
   return *this;
 }
 
 Predict& Predict::Output(Node output) {
   output_ = output;
+  plan_ = {};
   return *this;
 }
 
@@ -21,7 +32,38 @@ Predict& Predict::Size(int size) {
   return *this;
 }
 
+Predict& Predict::Workers(int workers) {
+  workers_ = workers;
+  return *this;
+}
+
+Predict& Predict::ShareMemory(bool share_memory) {
+  share_memory_ = share_memory;
+  plan_ = {};
+  return *this;
+}
+
+Predict& Predict::Quantize() {
+  ASSERT(inputs_.size() > 0);
+  std::vector<NodePtr> nodes =
+      NodeImpl::ForwardPassNodes(inputs_[0].node.get(), output_.get());
+
+  // The plans are captured again, since the nodes' commands change.
+  for (NodePtr node : nodes) {
+    node->StartCalibration();
+  }
+  plan_ = {};
+  Execute();
+
+  for (NodePtr node : nodes) {
+    node->Quantize();
+  }
+  plan_ = {};
+  return *this;
+}
+
 std::vector<std::vector<float>> Predict::Execute() {
+  TraceScope trace("predict", "Predict::Execute");
   std::vector<std::vector<float>> out;
   ASSERT(inputs_.size() > 0);
 
@@ -29,42 +71,71 @@ std::vector<std::vector<float>> Predict::Execute() {
   const int batch_size = reference_node->outputs[0].BatchSize();
   GPU& gpu = reference_node->gpu();
 
-  std::vector<NodePtr> forward_nodes =
-      NodeImpl::ForwardPassNodes(reference_node, output_.get());
+  // Prepare the batches in the background:
+  DataLoader loader;
+  for (PredictInputArgument& input : inputs_) {
+    loader.Input(input.generator, input.node->outputs[0].TotalSize());
+  }
+  loader.Size(size_)
+      .BatchSize(batch_size)
+      .Batches((size_ + batch_size - 1) / batch_size)
+      .Workers(workers_)
+      .Start();
 
+  if (plan_.empty()) {
+    plan_ = Plan::Inference(reference_node, output_.get());
+    if (share_memory_) {
+      plan_.ShareMemory(gpu);
+    }
+  }
 
+  // The parameters don't change during the prediction.
+  {
+    TraceScope trace_prepare("predict", "prepare");
+    plan_.Prepare();
+  }
+
+  out.resize(size_);
   for (int g = 0; g < size_; g += batch_size) {
+    TraceScope trace_step("predict", "step");
+
     // Fill inputs:
-    for (PredictInputArgument& input : inputs_) {
-      for (int i = 0; i < batch_size; ++i) {
-        const int local_offset = (g + i) % size_;
-        input.node->outputs[0].WritePartialBatch(
-            gpu, input.generator(local_offset), i);
+    const DataLoader::Batch& batch = loader.Next();
+    {
+      TraceScope trace_upload("predict", "upload");
+      for (int i = 0; i < inputs_.size(); ++i) {
+        inputs_[i].node->outputs[0].Write(gpu, batch.inputs[i]);
       }
     }
 
-    // Forward pass:
-    for (NodePtr node : forward_nodes) {
-      node->Forward();
-    }
-
-    // Copy back the predicted output.
-    std::vector<float> predictions = output_->outputs[0].Read(gpu);
+    // Forward pass, recorded into a single command buffer:
+    gpu.BeginStep();
+    plan_.Replay(gpu);
 
-    size_t begin = 0;
-    for (int i = 0; i < batch_size; ++i) {
-      if (out.size() >= size_) {
-        break;
+    // Copy back the predicted output. This doesn't block, so the next batch
+    // is submitted while this one is still in flight.
+    output_->outputs[0].ReadAsync(gpu, [&out, g, batch_size](
+                                           std::span<const float> values) {
+      TraceScope trace_readback("predict", "readback");
+      const size_t example_size = values.size() / batch_size;
+      for (int i = 0; i < batch_size && g + i < out.size(); ++i) {
+        auto begin = values.begin() + i * example_size;
+        out[g + i].assign(begin, begin + example_size);
       }
+    });
+    {
+      TraceScope trace_submit("predict", "submit");
+      gpu.EndStep();
+    }
 
-      std::vector<float> prediction;
-      size_t end = begin + predictions.size() / batch_size;
-      std::copy(predictions.begin() + begin, predictions.begin() + end,
-                std::back_inserter(prediction));
-      out.push_back(prediction);
-      begin = end;
+    // Bound the number of batches in flight.
+    gpu.Poll();
+    while (gpu.PendingOperations() > kMaxBatchesInFlight) {
+      gpu.WaitAny();
     }
   }
+  gpu.WaitAll();
 
+  loader_stats_ = loader.stats();
   return out;
 }
@@ -1,10 +1,12 @@
 #ifndef PREDICT_HPP
 #define PREDICT_HPP
 
-#include <functional>
 #include <span>
 #include <vector>
+#include "DataLoader.hpp"
+#include "Generator.hpp"
 #include "Node.hpp"
+#include "Plan.hpp"
 
 // Usage:
 // ------
@@ -18,21 +20,42 @@
 class Predict {
  public:
   Predict();
-  Predict& Input(Node input, std::function<std::span<float>(int)> generator);
+  // Provide the examples one by one:
+  Predict& Input(Node input, ExampleGenerator generator);
+  // Provide whole batches, uploaded at once:
+  Predict& Input(Node input, BatchGenerator generator);
   Predict& Output(Node output);
   Predict& Size(int size);
+  // The number of threads calling the generators.
+  Predict& Workers(int workers);
+  // Let the intermediate tensors not used at the same time share memory.
+  // Their values aren't kept after Execute(), except for the output's.
+  Predict& ShareMemory(bool share_memory);
+
+  // Convert the Linear and Conv2D nodes to int8, for serving. The inputs are
+  // predicted once, to calibrate the range of the nodes' inputs. The nodes use
+  // int8 in every following Predict. The graph must be inference-only, and
+  // the float weights are released.
+  Predict& Quantize();
+
+  // Statistics about the input pipeline of the last Execute().
+  const DataLoader::Stats& LoaderStats() const { return loader_stats_; }
 
   std::vector<std::vector<float>> Execute();
 
  private:
   struct PredictInputArgument {
     Node node;
-    std::function<std::span<float>(int)> generator;
+    BatchGenerator generator;
   };
 
   std::vector<PredictInputArgument> inputs_;
   Node output_;
+  Plan plan_;  // Built on the first Execute().
   size_t size_ = 0;
+  int workers_ = 1;
+  bool share_memory_ = false;
+  DataLoader::Stats loader_stats_;
 };
 
 #endif  // PREDICT_HPP
@@ -1,13 +1,50 @@
 #include "Shader.hpp"
 #include "GPU.hpp"
 
+namespace {
+
+// dot4_i8(a, b): the dot product of two vectors of 4 int8, packed in a u32.
+constexpr const char* kDot4I8 = R"(
+fn dot4_i8(a: u32, b: u32) -> i32 {
+  return dot4I8Packed(a, b);
+}
+)";
+
+constexpr const char* kDot4I8Emulated = R"(
+fn dot4_i8(a: u32, b: u32) -> i32 {
+  let x = bitcast<i32>(a);
+  let y = bitcast<i32>(b);
+  return dot(vec4<i32>(extractBits(x, 0u, 8u), extractBits(x, 8u, 8u),
+                       extractBits(x, 16u, 8u), extractBits(x, 24u, 8u)),
+             vec4<i32>(extractBits(y, 0u, 8u), extractBits(y, 8u, 8u),
+                       extractBits(y, 16u, 8u), extractBits(y, 24u, 8u)));
+}
+)";
+
+// The index of an invocation of NodePipeline::RunFlat().
+constexpr const char* kFlatIndex = R"(
+fn flat_index(id: vec3<u32>, num_workgroups: vec3<u32>,
+              workgroup_size: u32) -> u32 {
+  return id.x + id.y * num_workgroups.x * workgroup_size;
+}
+)";
+
+}  // namespace
+
 wgpu::ShaderModule Shader(GPU& gpu, const std::string& code) {
-  // Create a shader module that applies a function to each element of the
-  // buffer:
-  wgpu::ShaderModuleWGSLDescriptor wgslDesc;
-  wgslDesc.code = code.c_str();
-  wgpu::ShaderModuleDescriptor shaderModuleDescriptor{
-      .nextInChain = &wgslDesc,
-  };
-  return gpu.Device().CreateShaderModule(&shaderModuleDescriptor);
+  // The directives must come before any declaration.
+  std::string preamble;
+  if (gpu.HalfPrecision()) {
+    preamble += "enable f16;\n";
+  }
+  if (gpu.PackedDotProduct()) {
+    preamble += "enable chromium_experimental_dp4a;\n";
+  }
+
+  preamble += gpu.HalfPrecision()  //
+                  ? "alias real = f16;\n"
+                  : "alias real = f32;\n";
+  preamble += gpu.PackedDotProduct() ? kDot4I8 : kDot4I8Emulated;
+  preamble += kFlatIndex;
+  return gpu.CachedShaderModule(preamble + code);
 }
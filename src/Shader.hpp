@@ -4,6 +4,15 @@
 #include "GPU.hpp"
 #include <string>
 
+// Returns the shader module compiled from `code`. Modules are shared by every
+// node of the GPU using the same code.
+//
+// `code` can use the `real` type for the values of the tensors. It is f16 or
+// f32, depending on GPU::HalfPrecision(). It can also use
+// `dot4_i8(a: u32, b: u32) -> i32`, the dot product of 4 packed int8 values,
+// see GPU::PackedDotProduct(), and
+// `flat_index(id, num_workgroups, workgroup_size) -> u32`, the index of an
+// invocation of NodePipeline::RunFlat().
 wgpu::ShaderModule Shader(GPU& gpu, const std::string& code);
 
 #endif  // SHADER_HPP
@@ -1,8 +1,74 @@
 #include "Tensor.hpp"
 #include <assert.hpp>
+#include <cmath>
+#include <cstring>
+#include <memory>
 #include <random>
 #include "fmt/format.h"
 
+namespace {
+
+// IEEE 754 conversions between f32 and f16, rounding to the nearest even.
+uint16_t FloatToHalf(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  const uint32_t sign = (bits >> 16) & 0x8000;
+  const int exponent = int((bits >> 23) & 0xff) - 127 + 15;
+  uint32_t mantissa = bits & 0x7fffff;
+
+  // Infinity and NaN.
+  if (((bits >> 23) & 0xff) == 0xff) {
+    return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+  }
+  // Too large: infinity.
+  if (exponent >= 31) {
+    return sign | 0x7c00;
+  }
+  // Too small: zero.
+  if (exponent < -10) {
+    return sign;
+  }
+
+  // Subnormal values have no implicit leading 1.
+  int shift = 13;
+  uint32_t half = (uint32_t(exponent) << 10) | (mantissa >> 13);
+  if (exponent <= 0) {
+    mantissa |= 0x800000;
+    shift = 14 - exponent;
+    half = mantissa >> shift;
+  }
+  const uint32_t remainder = mantissa & ((1u << shift) - 1);
+  const uint32_t halfway = 1u << (shift - 1);
+  if (remainder > halfway || (remainder == halfway && (half & 1))) {
+    half++;  // May carry into the exponent, which is still correct.
+  }
+  return sign | half;
+}
+
+float HalfToFloat(uint16_t half) {
+  const bool negative = half & 0x8000;
+  const uint32_t exponent = (half >> 10) & 0x1f;
+  const uint32_t mantissa = half & 0x3ff;
+
+  // Zero and subnormal values.
+  if (exponent == 0) {
+    const float value = std::ldexp(float(mantissa), -24);
+    return negative ? -value : value;
+  }
+
+  uint32_t bits = (negative ? 0x80000000 : 0) | (mantissa << 13);
+  if (exponent == 31) {
+    bits |= 0x7f800000;  // Infinity and NaN.
+  } else {
+    bits |= (exponent - 15 + 127) << 23;
+  }
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+}  // namespace
+
 Tensor::Tensor(std::vector<int> size) : sizes_(size) {}
 
 Tensor::Tensor(const Tensor& other) {
@@ -12,7 +78,7 @@ Tensor::Tensor(const Tensor& other) {
 Tensor& Tensor::operator=(const Tensor& other) {
   sizes_ = other.sizes_;
   name_ = other.name_;
-  buffer_ = other.buffer_;
+  storage_ = other.storage_;
   return *this;
 }
 
@@ -24,8 +90,12 @@ int Tensor::TotalSize() {
   return size;
 }
 
+uint64_t Tensor::ByteSize(const GPU& gpu) {
+  return (TotalSize() * ElementSize(gpu) + 3) / 4 * 4;
+}
+
 void Tensor::CreateBuffer(GPU& gpu) {
-  if (buffer_) {
+  if (storage_->buffer) {
     return;
   }
 
@@ -33,10 +103,15 @@ void Tensor::CreateBuffer(GPU& gpu) {
       .label = name_.c_str(),
       .usage = wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopySrc |
                wgpu::BufferUsage::CopyDst,
-      .size = TotalSize() * sizeof(float),
+      .size = ByteSize(gpu),
       .mappedAtCreation = false,
   };
-  buffer_ = gpu.Device().CreateBuffer(&bufferDesc);
+  storage_->buffer = gpu.Device().CreateBuffer(&bufferDesc);
+}
+
+void Tensor::Alias(wgpu::Buffer buffer, uint64_t offset) {
+  storage_->buffer = buffer;
+  storage_->offset = offset;
 }
 
 void Tensor::Fill(GPU& gpu, float value) {
@@ -54,19 +129,35 @@ void Tensor::FillRandomGaussian(GPU& gpu, float mean, float stddev) {
 }
 
 void Tensor::Write(GPU& gpu, const std::vector<float>& data) {
-  wgpu::Device& device = gpu.Device();
-  CreateBuffer(gpu);
   ASSERT(data.size() == TotalSize());
-  gpu.Device().GetQueue().WriteBuffer(buffer_, 0, data.data(),
-                                      data.size() * sizeof(float));
+  WriteValues(gpu, data, 0);
 }
 
 void Tensor::WritePartial(GPU& gpu, const std::span<float> data, int offset) {
-  wgpu::Device& device = gpu.Device();
+  WriteValues(gpu, data, offset);
+}
+
+void Tensor::WriteValues(GPU& gpu, std::span<const float> data, int offset) {
   CreateBuffer(gpu);
   ASSERT(offset + data.size() <= TotalSize());
-  gpu.Device().GetQueue().WriteBuffer(buffer_, offset * sizeof(float),
-                                      data.data(), data.size() * sizeof(float));
+  if (!Half(gpu)) {
+    gpu.Device().GetQueue().WriteBuffer(Buffer(),
+                                        Offset() + offset * sizeof(float),
+                                        data.data(), data.size_bytes());
+    return;
+  }
+
+  // Writes are made of 4 bytes, so f16 values are written by pairs. An odd
+  // value at the end of the tensor is padded.
+  ASSERT(offset % 2 == 0);
+  ASSERT(data.size() % 2 == 0 || offset + data.size() == TotalSize());
+  std::vector<uint16_t> values((data.size() + 1) / 2 * 2, 0);
+  for (size_t i = 0; i < data.size(); ++i) {
+    values[i] = FloatToHalf(data[i]);
+  }
+  gpu.Device().GetQueue().WriteBuffer(
+      Buffer(), Offset() + offset * sizeof(uint16_t), values.data(),
+      values.size() * sizeof(uint16_t));
 }
 
 void Tensor::WritePartialBatch(GPU& gpu,
@@ -82,56 +173,115 @@ void Tensor::CopyTo(GPU& gpu, Tensor& other) {
 
 void Tensor::CopyFrom(GPU& gpu, Tensor& other) {
   ASSERT(sizes_ == other.sizes_);
+  ASSERT(Half(gpu) == other.Half(gpu));
   CreateBuffer(gpu);
   other.CreateBuffer(gpu);
-  wgpu::CommandEncoder encoder = gpu.Device().CreateCommandEncoder();
-  encoder.CopyBufferToBuffer(other.buffer_, 0, buffer_, 0,
-                             TotalSize() * sizeof(float));
-  wgpu::CommandBuffer commands = encoder.Finish();
-  gpu.Device().GetQueue().Submit(1, &commands);
+  gpu.Record({
+      .source = other.Buffer(),
+      .source_offset = other.Offset(),
+      .destination = Buffer(),
+      .destination_offset = Offset(),
+      .size = ByteSize(gpu),
+      .tensors = {&other, this},
+  });
 }
 
 std::vector<float> Tensor::Read(GPU& gpu) {
-  const int size = TotalSize();
-  std::vector<float> out(size);
-
-  gpu.Instance().ProcessEvents();
-  wgpu::BufferDescriptor bufferDesc = {
-      .label = "Readback buffer",
-      .usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::MapRead,
-      .size = size * sizeof(float),
-      .mappedAtCreation = false,
-  };
-  wgpu::Buffer map_buffer = gpu.Device().CreateBuffer(&bufferDesc);
-  wgpu::CommandEncoder encoder = gpu.Device().CreateCommandEncoder();
-  encoder.CopyBufferToBuffer(buffer_, 0, map_buffer, 0, size * sizeof(float));
-
-  wgpu::CommandBuffer commands = encoder.Finish();
-  gpu.Device().GetQueue().Submit(1, &commands);
+  std::vector<float> out(TotalSize());
+  Read(gpu, out);
+  return out;
+}
 
+void Tensor::Read(GPU& gpu, std::span<float> out, int offset) {
   bool done = false;
-  map_buffer.MapAsync(
-      wgpu::MapMode::Read, 0, size * sizeof(float),
-      [](WGPUBufferMapAsyncStatus status, void* userdata) {
-        bool* done = reinterpret_cast<bool*>(userdata);
-        *done = true;
-      },
-      reinterpret_cast<void*>(&done));
+  ReadAsync(gpu, offset, out.size(), [&](std::span<const float> values) {
+    std::memcpy(out.data(), values.data(), values.size_bytes());
+    done = true;
+  });
+
+  // Reading from inside a step: submit what was recorded so far.
+  gpu.Flush();
 
   while (!done) {
-    gpu.Instance().ProcessEvents();
+    gpu.Poll();
   }
+}
 
-  const float* output =
-      (const float*)map_buffer.GetConstMappedRange(0, size * sizeof(float));
-  if (!output) {
-    fmt::print("Failed to map buffer, during Tensor::Read\n");
-    exit(0);
-    return out;
-  }
-  for (int i = 0; i < size; i++) {
-    out[i] = output[i];
+void Tensor::ReadAsync(GPU& gpu, ReadCallback callback) {
+  ReadAsync(gpu, 0, TotalSize(), std::move(callback));
+}
+
+void Tensor::ReadAsync(GPU& gpu, int offset, int count, ReadCallback callback) {
+  ASSERT(offset + count <= TotalSize());
+  if (count == 0) {
+    callback({});
+    return;
   }
 
-  return out;
+  // Copies are made of 4 bytes, so f16 values are read by pairs.
+  const bool half = Half(gpu);
+  const int first = half ? offset / 2 * 2 : offset;
+  const uint64_t size =
+      half ? (offset + count - first + 1) / 2 * 4 : count * sizeof(float);
+
+  struct Request {
+    GPU* gpu;
+    wgpu::Buffer buffer;
+    uint64_t size;
+    bool half;
+    int skip;  // Values read before the requested ones.
+    int count;
+    ReadCallback callback;
+  };
+  auto* request = new Request{
+      .gpu = &gpu,
+      .buffer = gpu.AcquireReadbackBuffer(size),
+      .size = size,
+      .half = half,
+      .skip = offset - first,
+      .count = count,
+      .callback = std::move(callback),
+  };
+
+  gpu.Record({
+      .source = Buffer(),
+      .source_offset = Offset() + first * ElementSize(gpu),
+      .destination = request->buffer,
+      .size = size,
+      .tensors = {this},
+  });
+
+  // The buffer can only be mapped once the copy has been submitted.
+  gpu.BeginAsync();
+  gpu.AfterSubmit([request] {
+    request->buffer.MapAsync(
+        wgpu::MapMode::Read, 0, request->size,
+        [](WGPUBufferMapAsyncStatus status, void* userdata) {
+          std::unique_ptr<Request> request(
+              reinterpret_cast<Request*>(userdata));
+          const void* output =
+              request->buffer.GetConstMappedRange(0, request->size);
+          if (status != WGPUBufferMapAsyncStatus_Success || !output) {
+            fmt::print("Failed to map buffer, during Tensor::Read\n");
+            exit(0);
+            return;
+          }
+          if (request->half) {
+            const uint16_t* halves = (const uint16_t*)output + request->skip;
+            std::vector<float> values(request->count);
+            for (int i = 0; i < request->count; ++i) {
+              values[i] = HalfToFloat(halves[i]);
+            }
+            request->callback(values);
+          } else {
+            request->callback(
+                std::span<const float>((const float*)output, request->count));
+          }
+
+          request->buffer.Unmap();
+          request->gpu->ReleaseReadbackBuffer(request->buffer);
+          request->gpu->EndAsync();
+        },
+        reinterpret_cast<void*>(request));
+  });
 }
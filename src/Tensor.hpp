@@ -1,18 +1,22 @@
 #ifndef TENSOR_HPP
 #define TENSOR_HPP
 
+#include <functional>
+#include <memory>
 #include <span>
 #include <vector>
 #include "GPU.hpp"
 
-// An array of f16 values stored in the GPU. This is the input/output of a node.
+// An array of values stored in the GPU. This is the input/output of a node.
+// The values are f16 or f32, see SetFullPrecision(). The host always reads and
+// writes them as f32.
 class Tensor {
  public:
   Tensor() = default;
   Tensor(std::vector<int> size);
 
   // Tensor is copyable. Both the copy and the original will point to the same
-  // GPU buffer.
+  // GPU memory.
   Tensor(const Tensor& other);
   Tensor& operator=(const Tensor& other);
 
@@ -32,8 +36,44 @@ class Tensor {
 
   // Read operations:
   std::vector<float> Read(GPU& gpu);
+  // Read `out.size()` values, starting at `offset`, directly into `out`.
+  void Read(GPU& gpu, std::span<float> out, int offset = 0);
+  // Read `count` values, starting at `offset`, without blocking. The values
+  // are captured when ReadAsync is called, and are passed to `callback` from
+  // GPU::Poll() or GPU::Wait*() once they reach the host.
+  using ReadCallback = std::function<void(std::span<const float> values)>;
+  void ReadAsync(GPU& gpu, ReadCallback callback);
+  void ReadAsync(GPU& gpu, int offset, int count, ReadCallback callback);
 
-  wgpu::Buffer& Buffer() { return buffer_; }
+  // The tensor is stored in Buffer(), starting at Offset() bytes.
+  wgpu::Buffer& Buffer() { return storage_->buffer; }
+  uint64_t Offset() const { return storage_->offset; }
+
+  // Memory sharing:
+  // A transient tensor doesn't need to keep its values from one step to the
+  // next, so its memory can be shared with tensors used at other times of the
+  // step. See PlanMemory().
+  void SetTransient(bool transient) { storage_->transient = transient; }
+  bool Transient() const { return storage_->transient; }
+  // Move the tensor to `buffer`, starting at `offset` bytes. Its values are
+  // not preserved.
+  void Alias(wgpu::Buffer buffer, uint64_t offset);
+  // Whether the two tensors share the same memory.
+  bool SameStorage(const Tensor& other) const {
+    return storage_ == other.storage_;
+  }
+
+  // Precision:
+  // On a GPU using half precision, the tensor is stored as f16, unless it
+  // requires full precision, like the state of the optimizer.
+  void SetFullPrecision(bool full) { storage_->full_precision = full; }
+  bool Half(const GPU& gpu) const {
+    return gpu.HalfPrecision() && !storage_->full_precision;
+  }
+  uint64_t ElementSize(const GPU& gpu) const { return Half(gpu) ? 2 : 4; }
+  // The size of the tensor in bytes, padded to a multiple of 4 as required by
+  // the bindings and the copies.
+  uint64_t ByteSize(const GPU& gpu);
 
   int TotalSize();
   int BatchSize() const { return sizes_.back(); }
@@ -41,10 +81,19 @@ class Tensor {
 
  private:
   void CreateBuffer(GPU& gpu);
+  void WriteValues(GPU& gpu, std::span<const float> data, int offset);
 
   std::vector<int> sizes_;
   std::string name_ = "Tensor";
-  wgpu::Buffer buffer_;
+
+  // Shared by every copy of the tensor.
+  struct Storage {
+    wgpu::Buffer buffer;
+    uint64_t offset = 0;
+    bool transient = false;
+    bool full_precision = false;
+  };
+  std::shared_ptr<Storage> storage_ = std::make_shared<Storage>();
 };
 
 #endif  // TENSOR_HPP
@@ -0,0 +1,119 @@
+#include "Trace.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <vector>
+#include "fmt/format.h"
+
+namespace {
+
+struct Event {
+  const char* category;
+  std::string name;
+  int thread;
+  double begin;     // In microseconds, since Trace::Start().
+  double duration;  // In microseconds.
+};
+
+std::atomic<bool> g_enabled = false;
+std::mutex g_mutex;
+std::vector<Event> g_events;
+std::chrono::steady_clock::time_point g_start;
+
+double Now() {
+  return std::chrono::duration<double, std::micro>(
+             std::chrono::steady_clock::now() - g_start)
+      .count();
+}
+
+// Small ids, in the order the threads record their first event.
+int ThreadId() {
+  static std::atomic<int> next_id = 1;
+  thread_local int id = next_id++;
+  return id;
+}
+
+std::string Escape(const std::string& text) {
+  std::string out;
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+    }
+    out += c;
+  }
+  return out;
+}
+
+}  // namespace
+
+// static
+void Trace::Start() {
+  std::lock_guard<std::mutex> lock(g_mutex);
+  g_events.clear();
+  g_start = std::chrono::steady_clock::now();
+  g_enabled = true;
+}
+
+// static
+bool Trace::Stop(const std::string& path) {
+  g_enabled = false;
+  std::lock_guard<std::mutex> lock(g_mutex);
+
+  std::ofstream file(path);
+  if (!file) {
+    fmt::print(stderr, "Trace: failed to write {}\n", path);
+    return false;
+  }
+
+  file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+  bool first = true;
+  for (const Event& event : g_events) {
+    file << fmt::format(
+        "{}\n  {{\"ph\": \"X\", \"cat\": \"{}\", \"name\": \"{}\", "
+        "\"pid\": 1, \"tid\": {}, \"ts\": {:.3f}, \"dur\": {:.3f}}}",
+        first ? "" : ",", event.category, Escape(event.name), event.thread,
+        event.begin, event.duration);
+    first = false;
+  }
+  file << "\n]}\n";
+  g_events.clear();
+  return bool(file);
+}
+
+// static
+bool Trace::Enabled() {
+  return g_enabled;
+}
+
+TraceScope::TraceScope(const char* category, const char* name)
+    : enabled_(Trace::Enabled()), category_(category) {
+  if (enabled_) {
+    name_ = name;
+    begin_ = Now();
+  }
+}
+
+TraceScope::TraceScope(const char* category, std::string name)
+    : enabled_(Trace::Enabled()), category_(category) {
+  if (enabled_) {
+    name_ = std::move(name);
+    begin_ = Now();
+  }
+}
+
+TraceScope::~TraceScope() {
+  if (!enabled_) {
+    return;
+  }
+  const double end = Now();
+  std::lock_guard<std::mutex> lock(g_mutex);
+  g_events.push_back({
+      .category = category_,
+      .name = std::move(name_),
+      .thread = ThreadId(),
+      .begin = begin_,
+      .duration = end - begin_,
+  });
+}
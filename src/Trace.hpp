@@ -0,0 +1,44 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <string>
+
+// Records scoped events of the host threads, to be saved as a Chrome trace
+// JSON file, and opened in chrome://tracing or https://ui.perfetto.dev.
+//
+// Usage:
+// ------
+//  Trace::Start();
+//  Model()...Execute();
+//  Trace::Stop("trace.json");
+//
+// Model and Predict trace the input generation, the uploads, the recording of
+// every node, the submissions, the readbacks and the waits for the GPU.
+// Without a started trace, a TraceScope costs a single branch.
+class Trace {
+ public:
+  static void Start();
+  // Write the events recorded since Start() into `path`. Returns false if the
+  // file can't be written.
+  static bool Stop(const std::string& path);
+  static bool Enabled();
+};
+
+// An event lasting from its construction to its destruction.
+class TraceScope {
+ public:
+  TraceScope(const char* category, const char* name);
+  TraceScope(const char* category, std::string name);
+  ~TraceScope();
+
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+ private:
+  bool enabled_ = false;
+  const char* category_;
+  std::string name_;
+  double begin_ = 0.0;
+};
+
+#endif  // TRACE_HPP
@@ -0,0 +1,33 @@
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include "Trace.hpp"
+#include "gtest/gtest.h"
+
+TEST(Trace, ChromeTraceFile) {
+  const std::string path =
+      (std::filesystem::temp_directory_path() / "neural-webgpu-trace.json")
+          .string();
+
+  // Not recorded, since the trace isn't started.
+  { TraceScope scope("test", "before"); }
+
+  Trace::Start();
+  EXPECT_TRUE(Trace::Enabled());
+  {
+    TraceScope outer("test", "outer");
+    TraceScope inner("test", std::string("\"quoted\""));
+  }
+  ASSERT_TRUE(Trace::Stop(path));
+  EXPECT_FALSE(Trace::Enabled());
+
+  std::ifstream file(path);
+  std::stringstream content;
+  content << file.rdbuf();
+  const std::string json = content.str();
+  EXPECT_NE(json.find("\"traceEvents\""), std::string::npos);
+  EXPECT_NE(json.find("\"name\": \"outer\""), std::string::npos);
+  EXPECT_NE(json.find("\"name\": \"\\\"quoted\\\"\""), std::string::npos);
+  EXPECT_EQ(json.find("before"), std::string::npos);
+}
@@ -5,6 +5,7 @@
 #include "node/NodePipeline.hpp"
 #include "node/BatchNormalization.wgsl.hpp"
 
+#include <algorithm>
 #include <iostream>
 
 Node BatchNormalization(Node input) {
@@ -13,51 +14,102 @@ Node BatchNormalization(Node input) {
     std::string Name() override { return "BatchNormalization"; }
 
     int size_;
+    int channels_ = 1;
+    int chunks_ = 1;
     std::vector<int> sizes_;
 
+    Tensor partial_{{1}};
+    Tensor statistics_{{1}};
+    Tensor running_{{1}};
+
     Impl(Node input) : NodeImpl(input) {
       size_ = input->outputs[0].TotalSize();
       sizes_ = input->outputs[0].sizes();
 
+      // The channels are the dimension before the batch. For instance, the
+      // features of a [features][batch] tensor, or the channels of a
+      // [x][y][channels][batch] image.
+      const int batch_size = input->outputs[0].BatchSize();
+      channels_ = sizes_.size() >= 2 ? sizes_[sizes_.size() - 2] : 1;
+      const int inner = size_ / (channels_ * batch_size);
+
+      // Split the channels in chunks, so that there are enough workgroups to
+      // occupy the GPU, with at least one value per invocation.
+      const int channel_size = inner * batch_size;
+      const int target_chunks = (256 + channels_ - 1) / channels_;
+      const int chunk_size = std::max(
+          256, (channel_size + target_chunks - 1) / target_chunks);
+      chunks_ = (channel_size + chunk_size - 1) / chunk_size;
+
       outputs = {Tensor({sizes_})};
       outputs[0].Fill(gpu(), 0.f);
 
-      weights = {
-          Tensor({2}),
-      };
-      weights[0].Write(gpu(), {
-                                  1.f,  // scale
-                                  0.f,  // bias
-                              });
-
       SetupGradients();
 
+      partial_ = Tensor({2, chunks_, channels_});
+      partial_.SetName("BatchNormalization partial");
+      partial_.SetTransient(true);
+      partial_.SetFullPrecision(true);
+      statistics_ = Tensor({2, channels_});
+      statistics_.SetName("BatchNormalization statistics");
+      statistics_.SetTransient(true);
+      statistics_.SetFullPrecision(true);
+      // Inference-only nodes only use the running statistics.
+      if (training()) {
+        partial_.Fill(gpu(), 0.f);
+        statistics_.Fill(gpu(), 0.f);
+      }
+
+      running_ = Tensor({2, channels_});
+      running_.SetName("BatchNormalization running");
+      running_.SetFullPrecision(true);
+      std::vector<float> running(2 * channels_);
+      for (int c = 0; c < channels_; ++c) {
+        running[2 * c + 0] = 0.f;  // mean
+        running[2 * c + 1] = 1.f;  // variance
+      }
+      running_.Write(gpu(), running);
+
       wgpu::ShaderModule module =
-          Shader(gpu(), fmt::format(wgsl::BatchNormalization, size_));
+          Shader(gpu(), fmt::format(wgsl::BatchNormalization,  //
+                                    inner,                      //
+                                    channels_,                  //
+                                    batch_size,                 //
+                                    chunks_,                    //
+                                    chunk_size));
 
       pipeline_.Init(module, {
-                                 &weights[0],
                                  &input->outputs[0],
                                  &input->outputs_gradients[0],
                                  &outputs[0],
                                  &outputs_gradients[0],
+                                 &partial_,
+                                 &statistics_,
+                                 &running_,
                              });
     }
 
+    // Normalize with the statistics of the batch, and update the running
+    // ones.
     void Forward() override {
-      pipeline_.Run("fn_compute_weight", 64);
-      pipeline_.Run("fn_output",          //
-                    (size_ + 63) / 64,  //
-                    1,                    //
-                    1                     //
-      );
+      if (!training()) {
+        ForwardInference();
+        return;
+      }
+      pipeline_.Run("fn_partial_statistics", chunks_, channels_);
+      pipeline_.Run("fn_statistics", channels_);
+      RunElementwise("fn_output");
+    }
+
+    // Normalize with the running statistics.
+    void ForwardInference() override {
+      RunElementwise("fn_output_inference");
     }
-    void Backward() override {
-      pipeline_.Run("fn_input_gradient",  //
-                    (size_ + 63) / 64,  //
-                    1,                    //
-                    1                     //
-      );
+
+    void Backward() override { RunElementwise("fn_input_gradient"); }
+
+    void RunElementwise(std::string entrypoint) {
+      pipeline_.RunFlat(entrypoint, size_, 256);
     }
 
     NodePipeline pipeline_{gpu()};
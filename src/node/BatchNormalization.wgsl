@@ -1,67 +1,145 @@
-const size : u32 = {};
+// The input is [inner][channels][batch_size]. Every channel is normalized
+// with the mean and the variance of its values.
+const inner      : u32 = {};
+const channels   : u32 = {};
+const batch_size : u32 = {};
 
-// Weight
-@group(0) @binding(0) var<storage, read_write> weight: array<f32, 2>;
+// The values of a channel are reduced in `chunks` chunks of `chunk_size`
+// values, one workgroup each, and then the partial sums are added.
+const chunks     : u32 = {};
+const chunk_size : u32 = {};
+
+const size = inner * channels * batch_size;
+const channel_size = inner * batch_size;
+
+const epsilon = 1e-5;
+
+// The weight of the last batch in the running statistics.
+const momentum = 0.1;
 
 // Input
-@group(0) @binding(1) var<storage, read_write> input: array<f32, size>;
-@group(0) @binding(2) var<storage, read_write> input_gradient: array<f32, size>;
+@group(0) @binding(0) var<storage, read_write> input: array<real, size>;
+@group(0) @binding(1) var<storage, read_write> input_gradient: array<real, size>;
 
 // Output
-@group(0) @binding(3) var<storage, read_write> output: array<f32, size>;
-@group(0) @binding(4) var<storage, read_write> output_gradient: array<f32, size>;
-
-// Intermediary buffers:
-var<workgroup> sum_X1: array<f32, 64>;
-var<workgroup> sum_X2: array<f32, 64>;
-
-@compute @workgroup_size(64, 1, 1)
-fn fn_compute_weight(@builtin(local_invocation_id) id: vec3<u32>) {
-  // For each thread, compute X1 and X2 of the input buffer.
-  var X1: f32 = 0.0;
-  var X2: f32 = 0.0;
-  for(var i = id.x; i < size; i += 64) {
-    let x = input[i];
-    X1 += x;
-    X2 += x * x;
-  }
+@group(0) @binding(2) var<storage, read_write> output: array<real, size>;
+@group(0) @binding(3) var<storage, read_write> output_gradient: array<real, size>;
 
-  sum_X1[id.x] = X1;
-  sum_X2[id.x] = X2;
-  workgroupBarrier();
+// The sum and the sum of squares of each chunk.
+@group(0) @binding(4) var<storage, read_write> partial: array<vec2<f32>, chunks * channels>;
+
+// The (mean, 1 / standard deviation) of each channel over the batch.
+@group(0) @binding(5) var<storage, read_write> statistics: array<vec2<f32>, channels>;
+
+// The (mean, variance) of each channel, averaged over the training batches.
+// Used for inference.
+@group(0) @binding(6) var<storage, read_write> running: array<vec2<f32>, channels>;
+
+var<workgroup> sums: array<vec2<f32>, 256>;
 
-  // Reduce across the workgroup.
-  for(var i : u32 = 32; i != 0; i >>= 1) {
-    if (id.x < i) {
-      sum_X1[id.x] += sum_X1[id.x + i];
-      sum_X2[id.x] += sum_X2[id.x + i];
+fn reduce(local: u32, value: vec2<f32>) -> vec2<f32> {
+  sums[local] = value;
+  workgroupBarrier();
+  for (var stride = 128u; stride > 0; stride /= 2) {
+    if (local < stride) {
+      sums[local] += sums[local + stride];
     }
     workgroupBarrier();
   }
+  return sums[0];
+}
+
+// The index of the i-th value of the channel c.
+fn channel_index(c: u32, i: u32) -> u32 {
+  return i % inner + inner * (c + channels * (i / inner));
+}
 
-  if (id.x == 0) {
-    let X1 = sum_X1[0] / f32(size);
-    let X2 = sum_X2[0] / f32(size);
-    let variance = 1.0 / sqrt(X2 - X1 * X1);
-    weight[0] = (variance - weight[0]) * 0.1;
-    weight[1] = -X1 * weight[0];
+// The values are shifted by the first one of their channel, so that the
+// variance doesn't suffer from cancellation when the mean is large.
+fn shift(c: u32) -> f32 {
+  return f32(input[channel_index(c, 0)]);
+}
+
+// x: the chunk, y: the channel.
+@compute @workgroup_size(256, 1, 1)
+fn fn_partial_statistics(@builtin(workgroup_id) group: vec3<u32>,
+                         @builtin(local_invocation_index) local: u32) {
+  let c = group.y;
+  let begin = group.x * chunk_size;
+  let end = min(begin + chunk_size, channel_size);
+  let s = shift(c);
+
+  var sum = vec2<f32>(0.0);
+  for (var i = begin + local; i < end; i += 256) {
+    let x = f32(input[channel_index(c, i)]) - s;
+    sum += vec2<f32>(x, x * x);
+  }
+  sum = reduce(local, sum);
+
+  if (local == 0) {
+    partial[group.x + chunks * c] = sum;
+  }
+}
+
+// x: the channel.
+@compute @workgroup_size(256, 1, 1)
+fn fn_statistics(@builtin(workgroup_id) group: vec3<u32>,
+                 @builtin(local_invocation_index) local: u32) {
+  let c = group.x;
+
+  var sum = vec2<f32>(0.0);
+  for (var i = local; i < chunks; i += 256) {
+    sum += partial[i + chunks * c];
+  }
+  sum = reduce(local, sum);
+
+  if (local == 0) {
+    let mean = sum.x / f32(channel_size);
+    let variance = max(sum.y / f32(channel_size) - mean * mean, 0.0);
+    statistics[c] = vec2<f32>(shift(c) + mean,
+                              inverseSqrt(variance + epsilon));
+    running[c] = mix(running[c], vec2<f32>(shift(c) + mean, variance),
+                     momentum);
   }
 }
 
-@compute @workgroup_size(64, 1, 1)
-fn fn_output(@builtin(global_invocation_id) id: vec3<u32>) {
-  if (id.x >= size) {
+fn channel(i: u32) -> u32 {
+  return (i / inner) % channels;
+}
+
+@compute @workgroup_size(256, 1, 1)
+fn fn_output(@builtin(global_invocation_id) id: vec3<u32>,
+             @builtin(num_workgroups) num_workgroups: vec3<u32>) {
+  let i = flat_index(id, num_workgroups, 256);
+  if (i >= size) {
     return;
   }
-  
-  output[id.x] = input[id.x] * weight[0] + weight[1];
+
+  let s = statistics[channel(i)];
+  output[i] = real((f32(input[i]) - s.x) * s.y);
+}
+
+@compute @workgroup_size(256, 1, 1)
+fn fn_output_inference(@builtin(global_invocation_id) id: vec3<u32>,
+                       @builtin(num_workgroups) num_workgroups: vec3<u32>) {
+  let i = flat_index(id, num_workgroups, 256);
+  if (i >= size) {
+    return;
+  }
+
+  let r = running[channel(i)];
+  output[i] = real((f32(input[i]) - r.x) * inverseSqrt(r.y + epsilon));
 }
 
-@compute @workgroup_size(64, 1, 1)
-fn fn_input_gradient(@builtin(global_invocation_id) id: vec3<u32>) {
-  if (id.x >= size) {
+// The statistics are treated as constants.
+@compute @workgroup_size(256, 1, 1)
+fn fn_input_gradient(@builtin(global_invocation_id) id: vec3<u32>,
+                     @builtin(num_workgroups) num_workgroups: vec3<u32>) {
+  let i = flat_index(id, num_workgroups, 256);
+  if (i >= size) {
     return;
   }
 
-  input_gradient[id.x] = output_gradient[id.x] * weight[0];
+  input_gradient[i] =
+      real(f32(output_gradient[i]) * statistics[channel(i)].y);
 }
@@ -0,0 +1,63 @@
+#include <cmath>
+#include "GPU.hpp"
+#include "Node.hpp"
+#include "Tensor.hpp"
+#include "gtest/gtest.h"
+
+TEST(BatchNormalization, Forward_Backward) {
+  GPU gpu;
+
+  // [inner][channels][batch]. The batch is large enough to be reduced in
+  // several chunks.
+  const int inner = 3;
+  const int channels = 2;
+  const int batch_size = 500;
+
+  std::vector<float> input_values(inner * channels * batch_size);
+  std::vector<float> output_gradient_values(input_values.size());
+  for (int i = 0; i < input_values.size(); ++i) {
+    const int c = (i / inner) % channels;
+    input_values[i] = 1000.f * c + (i % 11);
+    output_gradient_values[i] = (i % 5) - 2;
+  }
+
+  Node input = Input(gpu, {inner, channels, batch_size});
+  input->outputs[0].Write(gpu, input_values);
+  Node normalization = BatchNormalization(input);
+  normalization->outputs_gradients[0].Write(gpu, output_gradient_values);
+  normalization->Forward();
+  normalization->Backward();
+
+  std::vector<double> mean(channels, 0.0);
+  std::vector<double> variance(channels, 0.0);
+  for (int i = 0; i < input_values.size(); ++i) {
+    mean[(i / inner) % channels] += input_values[i] / (inner * batch_size);
+  }
+  for (int i = 0; i < input_values.size(); ++i) {
+    const int c = (i / inner) % channels;
+    const double d = input_values[i] - mean[c];
+    variance[c] += d * d / (inner * batch_size);
+  }
+
+  const std::vector<float> output = normalization->outputs[0].Read(gpu);
+  const std::vector<float> input_gradient =
+      input->outputs_gradients[0].Read(gpu);
+  for (int i = 0; i < input_values.size(); ++i) {
+    const int c = (i / inner) % channels;
+    const double inv_std = 1.0 / std::sqrt(variance[c] + 1e-5);
+    EXPECT_NEAR(output[i], (input_values[i] - mean[c]) * inv_std, 1e-4);
+    EXPECT_NEAR(input_gradient[i], output_gradient_values[i] * inv_std, 1e-4);
+  }
+
+  // The running statistics moved from (0, 1) toward the batch ones.
+  normalization->ForwardInference();
+  const std::vector<float> inference = normalization->outputs[0].Read(gpu);
+  for (int i = 0; i < input_values.size(); ++i) {
+    const int c = (i / inner) % channels;
+    const double running_mean = 0.1 * mean[c];
+    const double running_variance = 0.9 + 0.1 * variance[c];
+    const double expected = (input_values[i] - running_mean) /
+                            std::sqrt(running_variance + 1e-5);
+    EXPECT_NEAR(inference[i], expected, 1e-3);
+  }
+}
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <assert.hpp>
 #include <iostream>
 
@@ -6,7 +7,10 @@
 #include "Tensor.hpp"
 #include "fmt/format.h"
 #include "node/Conv2D.wgsl.hpp"
+#include "node/Conv2DWinograd.wgsl.hpp"
+#include "node/Int8Quantizer.hpp"
 #include "node/NodePipeline.hpp"
+#include "node/Tiling.hpp"
 
 Node Conv2D(Node input, int kernel_size, int channels, int stride) {
   class Impl : public NodeImpl {
@@ -20,11 +24,30 @@ Node Conv2D(Node input, int kernel_size, int channels, int stride) {
     const int kernel_size_ = 1;
     const int stride_ = 1;
 
+    // Implicit matrix multiplications, see Conv2D.wgsl.
+    Tiling output_tiling_{1, 1};
+    Tiling input_gradient_tiling_{1, 1};
+    Tiling weight_gradient_tiling_{1, 1};
+    int weight_gradient_splits_ = 1;
+    Tensor weights_gradient_partial_{{1}};
+
+    // Winograd F(2x2, 3x3), for 3x3 kernels with stride 1. It replaces the
+    // output and input gradient passes. See Conv2DWinograd.wgsl.
+    bool winograd_ = false;
+    int winograd_output_invocations_ = 1;
+    int winograd_input_gradient_invocations_ = 1;
+    Tensor winograd_weights_{{1}};
+
+    // The rows of the input are along x. The rows of the weights are the
+    // weights of each output channel.
+    Int8Quantizer quantizer_;
+
     Impl(Node input, int kernel_size, int channels, int stride)
         : NodeImpl(input),
           kernel_size_(kernel_size),
           output_channels_(channels),
-          stride_(stride) {
+          stride_(stride),
+          quantizer_(gpu(), input->outputs[0], input->outputs[0].sizes()[0]) {
       const int input_dimensions = input->outputs[0].sizes().size();
       ASSERT(input_dimensions, "Conv2D input must be 4D.");
 
@@ -71,15 +94,49 @@ Node Conv2D(Node input, int kernel_size, int channels, int stride) {
 
       SetupGradients();
 
+      const int output_pixels = output_dx * output_dy * batch_size_;
+      const int input_pixels = input_dx * input_dy * batch_size_;
+      const int weights_per_output = kernel_size * kernel_size * input_channels;
+      output_tiling_ = Tiling(output_pixels, output_channels);
+      input_gradient_tiling_ = Tiling(input_pixels, input_channels);
+      weight_gradient_tiling_ = Tiling(weights_per_output, output_channels);
+      // fn_weight_gradient uses z for the splits of the reduction.
+      ASSERT(weight_gradient_tiling_.groups_z == 1,
+             "Conv2D: too many weights per output channel.");
+      const int weight_gradient_chunk =
+          SplitChunk(output_pixels, weight_gradient_tiling_);
+      weight_gradient_splits_ =
+          (output_pixels + weight_gradient_chunk - 1) / weight_gradient_chunk;
+
+      weights_gradient_partial_ = Tensor({
+          weight_gradient_splits_ > 1
+              ? weights[0].TotalSize() * weight_gradient_splits_
+              : 1,
+      });
+      weights_gradient_partial_.SetTransient(true);
+      weights_gradient_partial_.SetFullPrecision(true);
+      // Inference-only nodes don't need the partial sums.
+      if (training()) {
+        weights_gradient_partial_.Fill(gpu(), 0.f);
+      }
+
       wgpu::ShaderModule module =
-          Shader(gpu(), fmt::format(wgsl::Conv2D,      //
-                                    input_dx,          //
-                                    input_dy,          //
-                                    input_channels,    //
-                                    output_channels_,  //
-                                    kernel_size,       //
-                                    stride,            //
-                                    batch_size_));
+          Shader(gpu(), fmt::format(wgsl::Conv2D,                //
+                                    input_dx,                    //
+                                    input_dy,                    //
+                                    input_channels,              //
+                                    output_channels_,            //
+                                    kernel_size,                 //
+                                    stride,                      //
+                                    batch_size_,                 //
+                                    output_tiling_.rm,           //
+                                    output_tiling_.rn,           //
+                                    input_gradient_tiling_.rm,   //
+                                    input_gradient_tiling_.rn,   //
+                                    weight_gradient_tiling_.rm,  //
+                                    weight_gradient_tiling_.rn,  //
+                                    weight_gradient_splits_,     //
+                                    weight_gradient_chunk));
 
       pipeline_.Init(module, {
                                  &input->outputs[0],
@@ -88,34 +145,152 @@ Node Conv2D(Node input, int kernel_size, int channels, int stride) {
                                  &weights_gradients[0],
                                  &outputs[0],
                                  &outputs_gradients[0],
+                                 &weights_gradient_partial_,
+                                 &quantizer_.input,
+                                 &quantizer_.weights,
+                                 &quantizer_.scales,
                              });
+
+      winograd_ = kernel_size_ == 3 && stride_ == 1;
+      if (winograd_) {
+        InitWinograd(input);
+      }
     }
 
+    void InitWinograd(Node input) {
+      const int input_dx = input_sizes_[0];
+      const int input_dy = input_sizes_[1];
+      const int input_channels = input_sizes_[2];
+      const int output_dx = output_sizes_[0];
+      const int output_dy = output_sizes_[1];
+
+      // Each invocation computes a 2x2 tile for up to 4 channels.
+      const int output_rc = std::min(4, output_channels_);
+      const int input_gradient_rc = std::min(4, input_channels);
+      const int output_tiles =
+          ((output_dx + 1) / 2) * ((output_dy + 1) / 2) * batch_size_;
+      const int input_tiles =
+          ((input_dx + 1) / 2) * ((input_dy + 1) / 2) * batch_size_;
+      winograd_output_invocations_ =
+          output_tiles * ((output_channels_ + output_rc - 1) / output_rc);
+      winograd_input_gradient_invocations_ =
+          input_tiles *
+          ((input_channels + input_gradient_rc - 1) / input_gradient_rc);
+
+      winograd_weights_ = Tensor({4, 4, input_channels, output_channels_});
+      // Not transient, since the inference passes reuse the transformed
+      // weights from one batch to the next. See PrepareInference().
+      winograd_weights_.SetName("Conv2D winograd_weights");
+      winograd_weights_.SetFullPrecision(true);
+      winograd_weights_.Fill(gpu(), 0.f);
+
+      wgpu::ShaderModule module =
+          Shader(gpu(), fmt::format(wgsl::Conv2DWinograd,  //
+                                    input_dx,              //
+                                    input_dy,              //
+                                    input_channels,        //
+                                    output_channels_,      //
+                                    batch_size_,           //
+                                    output_rc,             //
+                                    input_gradient_rc));
+
+      winograd_pipeline_.Init(module, {
+                                          &input->outputs[0],
+                                          &input->outputs_gradients[0],
+                                          &weights[0],
+                                          &outputs[0],
+                                          &outputs_gradients[0],
+                                          &winograd_weights_,
+                                      });
+    }
+
+    // The weights change at every training step. The transformed weights are
+    // reused by Backward().
     void Forward() override {
-      pipeline_.Run("fn_output",                   //
-                    (output_sizes_[0] + 7 / 8),  //
-                    (output_sizes_[1] + 7 / 8),  //
-                    (output_sizes_[2] *            //
-                     output_sizes_[3])             //
+      if (winograd_) {
+        TransformWeights();
+      }
+      Output();
+    }
+
+    // The inference passes reuse the weights transformed by
+    // PrepareInference().
+    void PrepareInference() override {
+      if (winograd_ && !quantizer_.quantized()) {
+        TransformWeights();
+      }
+    }
+
+    void TransformWeights() {
+      const int kernels = winograd_weights_.TotalSize() / 16;
+      winograd_pipeline_.RunFlat("fn_weights_transform", kernels, 64);
+    }
+
+    void Output() {
+      if (winograd_) {
+        winograd_pipeline_.RunFlat("fn_output", winograd_output_invocations_,
+                                   64);
+        return;
+      }
+      pipeline_.Run("fn_output",               //
+                    output_tiling_.groups_x,  //
+                    output_tiling_.groups_y,  //
+                    output_tiling_.groups_z   //
       );
     }
 
+    void ForwardInference() override {
+      if (quantizer_.quantized()) {
+        const int output_pixels =
+            output_sizes_[0] * output_sizes_[1] * batch_size_;
+        const int channel_groups = (output_channels_ + 3) / 4;
+        quantizer_.QuantizeInput();
+        pipeline_.RunFlat("fn_output_int8", output_pixels * channel_groups, 64);
+        return;
+      }
+      Output();
+      if (quantizer_.calibrating()) {
+        quantizer_.Calibrate();
+      }
+    }
+
+    void StartCalibration() override {
+      ASSERT(!training(), "Only inference-only nodes can be quantized.");
+      quantizer_.StartCalibration();
+    }
+
+    // The float weights aren't used anymore. Their rows are the
+    // kernel_size * kernel_size * input_channels weights of an output channel.
+    void Quantize() override {
+      const int weights_per_output = weights[0].TotalSize() / output_channels_;
+      quantizer_.Quantize(weights[0], weights_per_output);
+      weights[0] = Tensor(weights[0].sizes());
+    }
+
     void Backward() override {
-      pipeline_.Run("fn_input_gradient",          //
-                    (input_sizes_[0] + 7) / 8,  //
-                    (input_sizes_[1] + 7) / 8,  //
-                    (input_sizes_[2] *            //
-                     input_sizes_[3])             //
-      );
+      if (winograd_) {
+        winograd_pipeline_.RunFlat("fn_input_gradient",
+                                   winograd_input_gradient_invocations_, 64);
+      } else {
+        pipeline_.Run("fn_input_gradient",               //
+                      input_gradient_tiling_.groups_x,  //
+                      input_gradient_tiling_.groups_y,  //
+                      input_gradient_tiling_.groups_z   //
+        );
+      }
       pipeline_.Run("fn_weight_gradient",               //
-                    (weights[0].sizes()[0] + 7) / 8,  //
-                    (weights[0].sizes()[1] + 7) / 8,  //
-                    (weights[0].sizes()[2] *            //
-                     weights[0].sizes()[3])             //
+                    weight_gradient_tiling_.groups_x,  //
+                    weight_gradient_tiling_.groups_y,  //
+                    weight_gradient_splits_            //
       );
+      if (weight_gradient_splits_ > 1) {
+        pipeline_.RunFlat("fn_weight_gradient_reduce",
+                          weights[0].TotalSize(), 64);
+      }
     }
 
     NodePipeline pipeline_{gpu()};
+    NodePipeline winograd_pipeline_{gpu()};
   };
   return std::make_shared<Impl>(input, kernel_size, channels, stride);
 }
@@ -14,143 +14,420 @@ const params_size = kernel_size * kernel_size * input_channels  * output_channel
 const output_size = output_dx   * output_dy   * output_channels * batch_size;
 
 // Input
-@group(0) @binding(0) var<storage, read_write> input: array<f32, input_size>;
-@group(0) @binding(1) var<storage, read_write> input_gradient: array<f32, input_size>;
+@group(0) @binding(0) var<storage, read_write> input: array<real, input_size>;
+@group(0) @binding(1) var<storage, read_write> input_gradient: array<real, input_size>;
 
 // Params
-@group(0) @binding(2) var<storage, read_write> weights: array<f32, params_size>;
-@group(0) @binding(3) var<storage, read_write> weights_gradient: array<f32, params_size>;
+@group(0) @binding(2) var<storage, read_write> weights: array<real, params_size>;
+@group(0) @binding(3) var<storage, read_write> weights_gradient: array<real, params_size>;
 
 // Output
-@group(0) @binding(4) var<storage, read_write> output: array<f32, output_size>;
-@group(0) @binding(5) var<storage, read_write> output_gradient: array<f32, output_size>;
-
-@compute @workgroup_size(8, 8, 1)
-fn fn_output(@builtin(global_invocation_id) id: vec3<u32>) {
-  let o_x = id.x;
-  let o_y = id.y;
-  let o_c = id.z % output_channels;
-  let b = id.z / output_channels;
-
-  if (o_x >= output_dx || //
-      o_y >= output_dy ) {
+@group(0) @binding(4) var<storage, read_write> output: array<real, output_size>;
+@group(0) @binding(5) var<storage, read_write> output_gradient: array<real, output_size>;
+
+// Partial sums of the weights gradient, one per split of the output pixels.
+// See fn_weight_gradient.
+@group(0) @binding(6) var<storage, read_write> weights_gradient_partial: array<f32>;
+
+// Int8 quantization, see Int8Quantizer.hpp. The rows of the input are packed
+// by 4 values along x, and the weights of each output channel by 4 values
+// along (w_x, w_y, i_c). The sums are scaled per output channel by `scales`.
+const input_words_x = (input_dx + 3) / 4;
+const weight_words = (kernel_size * kernel_size * input_channels + 3) / 4;
+@group(0) @binding(7) var<storage, read_write> quantized_input: array<u32, input_words_x * input_dy * input_channels * batch_size>;
+@group(0) @binding(8) var<storage, read_write> quantized_weights: array<u32, weight_words * output_channels>;
+@group(0) @binding(9) var<storage, read_write> scales: array<f32, output_channels>;
+
+// Implicit matrix multiplications
+// --------------------------------
+// The convolution and its gradients are matrix multiplications, whose
+// operands are read from the tensors on the fly, without being materialized:
+//
+// - fn_output:          output[pixel][o_c] = im2col[pixel][w] x weights[w][o_c]
+// - fn_input_gradient:  input_gradient[pixel][i_c] =
+//                         col2im[pixel][w'] x weights[w'][i_c]
+// - fn_weight_gradient: weights_gradient[w][o_c] =
+//                         im2col[pixel][w]^T x output_gradient[pixel][o_c]
+//
+// where a pixel is (x, y, batch), w is (w_x, w_y, i_c) and w' is
+// (w_x, w_y, o_c).
+//
+// They are tiled like in Linear.wgsl: a workgroup of 16x16 invocations
+// computes a tile of (16*rm)x(16*rn) values, staging tiles of both operands in
+// workgroup memory, and each invocation computes rm pixels or weights for rn
+// channels.
+const output_rm : u32 = {};
+const output_rn : u32 = {};
+const input_gradient_rm : u32 = {};
+const input_gradient_rn : u32 = {};
+const weight_gradient_rm : u32 = {};
+const weight_gradient_rn : u32 = {};
+const weight_gradient_splits : u32 = {};
+const weight_gradient_chunk : u32 = {};
+
+const output_pixels = output_dx * output_dy * batch_size;
+const input_pixels = input_dx * input_dy * batch_size;
+const kernel_area = kernel_size * kernel_size;
+const weights_per_output = kernel_area * input_channels;
+const weights_per_input = kernel_area * output_channels;
+
+const tile_k = 16u;
+const tile_max = 64u;
+var<workgroup> tile_a: array<f32, tile_k * tile_max>;
+var<workgroup> tile_b: array<f32, tile_k * tile_max>;
+
+fn input_index(pixel: u32, i_c: u32) -> u32 {
+  let i_x = pixel % input_dx;
+  let i_y = (pixel / input_dx) % input_dy;
+  let b = pixel / (input_dx * input_dy);
+  return i_x + input_dx * (
+         i_y + input_dy * (
+         i_c + input_channels * (
+         b
+  )));
+}
+
+fn output_index(pixel: u32, o_c: u32) -> u32 {
+  let o_x = pixel % output_dx;
+  let o_y = (pixel / output_dx) % output_dy;
+  let b = pixel / (output_dx * output_dy);
+  return o_x + output_dx * (
+         o_y + output_dy * (
+         o_c + output_channels * (
+         b
+  )));
+}
+
+// The input multiplied by the weight w = (w_x, w_y, i_c) to compute the output
+// pixel (o_x, o_y, b).
+fn im2col(pixel: u32, w: u32) -> f32 {
+  let o_x = pixel % output_dx;
+  let o_y = (pixel / output_dx) % output_dy;
+  let b = pixel / (output_dx * output_dy);
+  let w_x = w % kernel_size;
+  let w_y = (w / kernel_size) % kernel_size;
+  let i_c = w / kernel_area;
+  let i_x = o_x * stride + w_x;
+  let i_y = o_y * stride + w_y;
+  return f32(input[i_x + input_dx * (
+                   i_y + input_dy * (
+                   i_c + input_channels * (
+                   b
+  )))]);
+}
+
+// The gradient of the output pixel computed from the input pixel
+// (i_x, i_y, b) through the weight w = (w_x, w_y, o_c). Zero if there is none.
+fn col2im(pixel: u32, w: u32) -> f32 {
+  let i_x = pixel % input_dx;
+  let i_y = (pixel / input_dx) % input_dy;
+  let b = pixel / (input_dx * input_dy);
+  let w_x = w % kernel_size;
+  let w_y = (w / kernel_size) % kernel_size;
+  let o_c = w / kernel_area;
+  if (i_x < w_x || i_y < w_y) {
+    return 0.0;
+  }
+  let d_x = i_x - w_x;
+  let d_y = i_y - w_y;
+  if (d_x % stride != 0 || d_y % stride != 0) {
+    return 0.0;
+  }
+  let o_x = d_x / stride;
+  let o_y = d_y / stride;
+  if (o_x >= output_dx || o_y >= output_dy) {
+    return 0.0;
+  }
+  return f32(output_gradient[o_x + output_dx * (
+                             o_y + output_dy * (
+                             o_c + output_channels * (
+                             b
+  )))]);
+}
+
+// The int8 input at (i_x, i_y, i_c, b), in the lowest byte.
+fn quantized_input_byte(i_x: u32, i_y: u32, i_c: u32, b: u32) -> u32 {
+  let row = i_y + input_dy * (i_c + input_channels * b);
+  let word = quantized_input[i_x / 4 + input_words_x * row];
+  return extractBits(word, 8 * (i_x % 4), 8u);
+}
+
+// The same as fn_output, with int8 input and weights. The 4 input values of
+// each word of the weights are gathered, and packed again.
+//
+// One invocation per output pixel and group of 4 output channels, the pixels
+// first. See NodePipeline::RunFlat().
+@compute @workgroup_size(64, 1, 1)
+fn fn_output_int8(@builtin(global_invocation_id) id: vec3<u32>,
+                  @builtin(num_workgroups) num_workgroups: vec3<u32>) {
+  let i = flat_index(id, num_workgroups, 64);
+  if (i >= output_pixels * ((output_channels + 3) / 4)) {
     return;
   }
+  let pixel = i % output_pixels;
+  let o_x = pixel % output_dx;
+  let o_y = (pixel / output_dx) % output_dy;
+  let b = pixel / (output_dx * output_dy);
+  let o_c0 = 4 * (i / output_pixels);
 
-  var sum = 0.f;
-  for (var i_c : u32 = 0; i_c < input_channels; i_c++) {
-    for (var w_y : u32 = 0; w_y < kernel_size; w_y++) {
-      for (var w_x : u32 = 0; w_x < kernel_size; w_x++) {
-        let i_x = w_x + stride * o_x;
-        let i_y = w_y + stride * o_y;
-        let input_index = i_x + input_dx * (
-                          i_y + input_dy * (
-                          i_c + input_channels * (
-                          b
-        )));
-        let weight_index = w_x + kernel_size * (
-                           w_y + kernel_size * (
-                           i_c + input_channels * (
-                           o_c  
-        )));
-        sum += input[input_index] * weights[weight_index];
+  var sum = vec4<i32>(0);
+  for (var word = 0u; word < weight_words; word++) {
+    var packed = 0u;
+    for (var u = 0u; u < 4; u++) {
+      let w = 4 * word + u;
+      if (w < weights_per_output) {
+        let w_x = w % kernel_size;
+        let w_y = (w / kernel_size) % kernel_size;
+        let i_c = w / kernel_area;
+        packed |= quantized_input_byte(o_x * stride + w_x,
+                                       o_y * stride + w_y,
+                                       i_c, b) << (8 * u);
+      }
+    }
+    for (var r = 0u; r < 4; r++) {
+      if (o_c0 + r < output_channels) {
+        sum[r] += dot4_i8(packed,
+                          quantized_weights[word + weight_words * (o_c0 + r)]);
       }
     }
   }
-  let output_index = o_x + output_dx * (
-                     o_y + output_dy * (
-                     o_c + output_channels * (
-                     b 
-  )));
-  output[output_index] = sum;
+
+  for (var r = 0u; r < 4; r++) {
+    let o_c = o_c0 + r;
+    if (o_c < output_channels) {
+      output[output_index(pixel, o_c)] = real(f32(sum[r]) * scales[o_c]);
+    }
+  }
 }
 
-@compute @workgroup_size(8, 8, 1)
-fn fn_input_gradient(@builtin(global_invocation_id) id: vec3<u32>) {
-  let i_x = id.x;
-  let i_y = id.y;
-  let i_c = id.z % input_channels;
-  let b = id.z / input_channels;
+// M = output_pixels, N = output_channels, K = weights_per_output.
+@compute @workgroup_size(16, 16, 1)
+fn fn_output(@builtin(workgroup_id) group: vec3<u32>,
+             @builtin(num_workgroups) num_workgroups: vec3<u32>,
+             @builtin(local_invocation_id) local: vec3<u32>,
+             @builtin(local_invocation_index) index: u32) {
+  const rm = output_rm;
+  const rn = output_rn;
+  const tm = 16 * rm;
+  const tn = 16 * rn;
+  // The rows of tiles over the dispatch limit are folded into z. See Tiling.
+  let m0 = (group.y + group.z * num_workgroups.y) * tm;
+  let n0 = group.x * tn;
+  if (m0 >= output_pixels) {
+    return;
+  }
+
+  var sum: array<f32, rm * rn>;
+  for (var k0 = 0u; k0 < weights_per_output; k0 += tile_k) {
+    // The input is contiguous along the pixels, the weights along k.
+    for (var i = index; i < tm * tile_k; i += 256) {
+      let m = i % tm;
+      let k = i / tm;
+      var value = 0.0;
+      if (m0 + m < output_pixels && k0 + k < weights_per_output) {
+        value = im2col(m0 + m, k0 + k);
+      }
+      tile_a[k * tm + m] = value;
+    }
+    for (var i = index; i < tn * tile_k; i += 256) {
+      let k = i % tile_k;
+      let n = i / tile_k;
+      var value = 0.0;
+      if (n0 + n < output_channels && k0 + k < weights_per_output) {
+        value = f32(weights[(k0 + k) + weights_per_output * (n0 + n)]);
+      }
+      tile_b[k * tn + n] = value;
+    }
+    workgroupBarrier();
 
-  if (i_x >= input_dx || //
-      i_y >= input_dy) {
+    for (var k = 0u; k < tile_k; k++) {
+      var a: array<f32, rm>;
+      var b: array<f32, rn>;
+      for (var i = 0u; i < rm; i++) {
+        a[i] = tile_a[k * tm + local.y + 16 * i];
+      }
+      for (var j = 0u; j < rn; j++) {
+        b[j] = tile_b[k * tn + local.x + 16 * j];
+      }
+      for (var i = 0u; i < rm; i++) {
+        for (var j = 0u; j < rn; j++) {
+          sum[i * rn + j] += a[i] * b[j];
+        }
+      }
+    }
+    workgroupBarrier();
+  }
+
+  for (var i = 0u; i < rm; i++) {
+    for (var j = 0u; j < rn; j++) {
+      let m = m0 + local.y + 16 * i;
+      let n = n0 + local.x + 16 * j;
+      if (m < output_pixels && n < output_channels) {
+        output[output_index(m, n)] = real(sum[i * rn + j]);
+      }
+    }
+  }
+}
+
+// M = input_pixels, N = input_channels, K = weights_per_input.
+@compute @workgroup_size(16, 16, 1)
+fn fn_input_gradient(@builtin(workgroup_id) group: vec3<u32>,
+                     @builtin(num_workgroups) num_workgroups: vec3<u32>,
+                     @builtin(local_invocation_id) local: vec3<u32>,
+                     @builtin(local_invocation_index) index: u32) {
+  const rm = input_gradient_rm;
+  const rn = input_gradient_rn;
+  const tm = 16 * rm;
+  const tn = 16 * rn;
+  // The rows of tiles over the dispatch limit are folded into z. See Tiling.
+  let m0 = (group.y + group.z * num_workgroups.y) * tm;
+  let n0 = group.x * tn;
+  if (m0 >= input_pixels) {
     return;
   }
 
-  var sum = 0.0;
-  for (var o_c : u32 = 0; o_c < output_channels; o_c++) {
-    // Find every (i_x,i) that i + stride * i_x == i_x;
-    // Find every (i_y,j) that j + stride * i_y == i_y;
-    for (var w_y : u32 = i_y % stride; w_y < min(kernel_size, i_y + 1); w_y += stride) {
-      let o_y = (i_y - w_y) / stride;
-      if (o_y >= output_dy) {
-        continue;
-      }
-      for (var w_x : u32 = i_x % stride; w_x < min(kernel_size, i_x + 1); w_x += stride) {
-        let o_x = (i_x - w_x) / stride;
-        if (o_x >= output_dx) {
-          continue;
+  var sum: array<f32, rm * rn>;
+  for (var k0 = 0u; k0 < weights_per_input; k0 += tile_k) {
+    // The output gradient is contiguous along the pixels, the weights along k.
+    for (var i = index; i < tm * tile_k; i += 256) {
+      let m = i % tm;
+      let k = i / tm;
+      var value = 0.0;
+      if (m0 + m < input_pixels && k0 + k < weights_per_input) {
+        value = col2im(m0 + m, k0 + k);
+      }
+      tile_a[k * tm + m] = value;
+    }
+    for (var i = index; i < tn * tile_k; i += 256) {
+      let k = i % tile_k;
+      let n = i / tile_k;
+      var value = 0.0;
+      if (n0 + n < input_channels && k0 + k < weights_per_input) {
+        let w_xy = (k0 + k) % kernel_area;
+        let o_c = (k0 + k) / kernel_area;
+        value = f32(
+            weights[w_xy + kernel_area * ((n0 + n) + input_channels * o_c)]);
+      }
+      tile_b[k * tn + n] = value;
+    }
+    workgroupBarrier();
+
+    for (var k = 0u; k < tile_k; k++) {
+      var a: array<f32, rm>;
+      var b: array<f32, rn>;
+      for (var i = 0u; i < rm; i++) {
+        a[i] = tile_a[k * tm + local.y + 16 * i];
+      }
+      for (var j = 0u; j < rn; j++) {
+        b[j] = tile_b[k * tn + local.x + 16 * j];
+      }
+      for (var i = 0u; i < rm; i++) {
+        for (var j = 0u; j < rn; j++) {
+          sum[i * rn + j] += a[i] * b[j];
         }
+      }
+    }
+    workgroupBarrier();
+  }
 
-        let output_index = o_x + output_dx * (
-                           o_y + output_dy * (
-                           o_c + output_channels * (
-                           b
-        )));
-        let weight_index = w_x + kernel_size * (
-                           w_y + kernel_size * (
-                           i_c + input_channels * (
-                           o_c
-        )));
-        sum += output_gradient[output_index] * weights[weight_index];
+  for (var i = 0u; i < rm; i++) {
+    for (var j = 0u; j < rn; j++) {
+      let m = m0 + local.y + 16 * i;
+      let n = n0 + local.x + 16 * j;
+      if (m < input_pixels && n < input_channels) {
+        input_gradient[input_index(m, n)] = real(sum[i * rn + j]);
       }
     }
   }
-  let input_index = i_x + input_dx * (
-                    i_y + input_dy * (
-                    i_c + input_channels * (
-                    b
-  )));
-  input_gradient[input_index] = sum;
 }
 
-@compute @workgroup_size(8, 8, 1)
-fn fn_weight_gradient(@builtin(global_invocation_id) id: vec3<u32>) {
-  let w_x = id.x;
-  let w_y = id.y;
-  let i_c = id.z % input_channels;
-  let o_c = id.z / input_channels;
+// M = weights_per_output, N = output_channels, K = output_pixels.
+//
+// There are usually few weights, and many pixels. The pixels are then split
+// into `weight_gradient_splits` chunks, one per workgroup along z. Each chunk
+// writes its partial sums, and fn_weight_gradient_reduce adds them.
+@compute @workgroup_size(16, 16, 1)
+fn fn_weight_gradient(@builtin(workgroup_id) group: vec3<u32>,
+                      @builtin(local_invocation_id) local: vec3<u32>,
+                      @builtin(local_invocation_index) index: u32) {
+  const rm = weight_gradient_rm;
+  const rn = weight_gradient_rn;
+  const tm = 16 * rm;
+  const tn = 16 * rn;
+  let m0 = group.y * tm;
+  let n0 = group.x * tn;
+  let k_begin = group.z * weight_gradient_chunk;
+  let k_end = min(k_begin + weight_gradient_chunk, output_pixels);
 
-  if (w_x >= kernel_size || //
-      w_y >= kernel_size) {
-    return;
+  var sum: array<f32, rm * rn>;
+  for (var k0 = k_begin; k0 < k_end; k0 += tile_k) {
+    // Both operands are contiguous along the pixels.
+    for (var i = index; i < tm * tile_k; i += 256) {
+      let k = i % tile_k;
+      let m = i / tile_k;
+      var value = 0.0;
+      if (m0 + m < weights_per_output && k0 + k < k_end) {
+        value = im2col(k0 + k, m0 + m);
+      }
+      tile_a[k * tm + m] = value;
+    }
+    for (var i = index; i < tn * tile_k; i += 256) {
+      let k = i % tile_k;
+      let n = i / tile_k;
+      var value = 0.0;
+      if (n0 + n < output_channels && k0 + k < k_end) {
+        value = f32(output_gradient[output_index(k0 + k, n0 + n)]);
+      }
+      tile_b[k * tn + n] = value;
+    }
+    workgroupBarrier();
+
+    for (var k = 0u; k < tile_k; k++) {
+      var a: array<f32, rm>;
+      var b: array<f32, rn>;
+      for (var i = 0u; i < rm; i++) {
+        a[i] = tile_a[k * tm + local.y + 16 * i];
+      }
+      for (var j = 0u; j < rn; j++) {
+        b[j] = tile_b[k * tn + local.x + 16 * j];
+      }
+      for (var i = 0u; i < rm; i++) {
+        for (var j = 0u; j < rn; j++) {
+          sum[i * rn + j] += a[i] * b[j];
+        }
+      }
+    }
+    workgroupBarrier();
   }
 
-  var sum = 0.0;
-  for (var b : u32 = 0; b < batch_size; b++) {
-    for (var o_y : u32 = 0; o_y < output_dy; o_y++) {
-      for (var o_x : u32 = 0; o_x < output_dx; o_x++) {
-        let i_x = o_x * stride + w_x;
-        let i_y = o_y * stride + w_y;
-
-        let input_index = i_x + input_dx * (
-                          i_y + input_dy * (
-                          i_c + input_channels * (
-                          b
-        )));
-        let output_index = o_x + output_dx * (
-                           o_y + output_dy * (
-                           o_c + output_channels * (
-                           b
-        )));
-        sum += input[input_index] * output_gradient[output_index];
+  for (var i = 0u; i < rm; i++) {
+    for (var j = 0u; j < rn; j++) {
+      let m = m0 + local.y + 16 * i;
+      let n = n0 + local.x + 16 * j;
+      if (m < weights_per_output && n < output_channels) {
+        let weight_index = m + weights_per_output * n;
+        if (weight_gradient_splits == 1) {
+          weights_gradient[weight_index] = real(sum[i * rn + j]);
+        } else {
+          weights_gradient_partial[weight_index + params_size * group.z] =
+              sum[i * rn + j];
+        }
       }
     }
   }
-  let weight_index = w_x + kernel_size * (
-                     w_y + kernel_size * (
-                     i_c + input_channels * (
-                     o_c
-  )));
-  weights_gradient[weight_index] = sum;
+}
+
+@compute @workgroup_size(64, 1, 1)
+fn fn_weight_gradient_reduce(@builtin(global_invocation_id) id: vec3<u32>,
+                             @builtin(num_workgroups) num_workgroups: vec3<u32>) {
+  let w = flat_index(id, num_workgroups, 64);
+  if (w >= params_size) {
+    return;
+  }
+
+  var sum = 0.0;
+  for (var split = 0u; split < weight_gradient_splits; split++) {
+    sum += weights_gradient_partial[w + params_size * split];
+  }
+  weights_gradient[w] = real(sum);
 }
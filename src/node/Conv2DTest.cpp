@@ -86,6 +86,158 @@ TEST(Conv2D, Forward_Backward) {
   EXPECT_EQ(output, expected_output);
 }
 
+TEST(Conv2D, Winograd) {
+  GPU gpu;
+
+  // 3x3 kernels with stride 1 use Winograd F(2x2, 3x3). The odd sizes leave
+  // partial tiles, and 5 channels a partial group of channels.
+  const int input_dx = 5;
+  const int input_dy = 4;
+  const int input_channels = 3;
+  const int output_channels = 5;
+  const int batch_size = 2;
+  const int output_dx = input_dx - 2;
+  const int output_dy = input_dy - 2;
+
+  std::vector<float> input_values(input_dx * input_dy * input_channels *
+                                  batch_size);
+  std::vector<float> weight_values(9 * input_channels * output_channels);
+  std::vector<float> output_gradient_values(output_dx * output_dy *
+                                            output_channels * batch_size);
+  for (int i = 0; i < input_values.size(); ++i) {
+    input_values[i] = (i % 7) - 3;
+  }
+  for (int i = 0; i < weight_values.size(); ++i) {
+    weight_values[i] = (i % 5) - 2;
+  }
+  for (int i = 0; i < output_gradient_values.size(); ++i) {
+    output_gradient_values[i] = (i % 3) - 1;
+  }
+
+  Node input = Input(gpu, {input_dx, input_dy, input_channels, batch_size});
+  input->outputs[0].Write(gpu, input_values);
+  Node convolution = Conv2D(input, /*kernel=*/3, /*channels=*/output_channels);
+  convolution->weights[0].Write(gpu, weight_values);
+  convolution->outputs_gradients[0].Write(gpu, output_gradient_values);
+  convolution->Forward();
+  convolution->Backward();
+
+  std::vector<float> expected_output(output_gradient_values.size(), 0.f);
+  std::vector<float> expected_input_gradient(input_values.size(), 0.f);
+  for (int b = 0; b < batch_size; ++b) {
+    for (int o_c = 0; o_c < output_channels; ++o_c) {
+      for (int i_c = 0; i_c < input_channels; ++i_c) {
+        for (int o_y = 0; o_y < output_dy; ++o_y) {
+          for (int o_x = 0; o_x < output_dx; ++o_x) {
+            const int o =
+                o_x +
+                output_dx * (o_y + output_dy * (o_c + output_channels * b));
+            for (int w_y = 0; w_y < 3; ++w_y) {
+              for (int w_x = 0; w_x < 3; ++w_x) {
+                const int w =
+                    w_x + 3 * (w_y + 3 * (i_c + input_channels * o_c));
+                const int i =
+                    (o_x + w_x) +
+                    input_dx * ((o_y + w_y) +
+                                input_dy * (i_c + input_channels * b));
+                expected_output[o] += input_values[i] * weight_values[w];
+                expected_input_gradient[i] +=
+                    output_gradient_values[o] * weight_values[w];
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  const std::vector<float> output = convolution->outputs[0].Read(gpu);
+  for (int i = 0; i < output.size(); ++i) {
+    EXPECT_NEAR(output[i], expected_output[i], 1e-3);
+  }
+  const std::vector<float> input_gradient =
+      input->outputs_gradients[0].Read(gpu);
+  for (int i = 0; i < input_gradient.size(); ++i) {
+    EXPECT_NEAR(input_gradient[i], expected_input_gradient[i], 1e-3);
+  }
+}
+
+// The inference passes reuse the weights transformed once per Execute().
+TEST(Conv2D, WinogradInference) {
+  GPU gpu;
+  Node input = Input(gpu, {4, 4, 1, 1}, /*training=*/false);
+  Node convolution = Conv2D(input, /*kernel=*/3, /*channels=*/1);
+
+  std::vector<std::vector<float>> examples = {
+      std::vector<float>(16, 1.f),
+      std::vector<float>(16, 2.f),
+  };
+  auto predict = [&] {
+    return Predict()
+        .Input(input, [&](int i) { return std::span(examples[i]); })
+        .Output(convolution)
+        .Size(examples.size())
+        .Execute();
+  };
+
+  for (float weight : {1.f, 3.f}) {
+    convolution->weights[0].Fill(gpu, weight);
+    const std::vector<std::vector<float>> outputs = predict();
+    ASSERT_EQ(outputs.size(), examples.size());
+    for (int i = 0; i < outputs.size(); ++i) {
+      for (float value : outputs[i]) {
+        EXPECT_NEAR(value, 9.f * weight * examples[i][0], 1e-3);
+      }
+    }
+  }
+}
+
+TEST(Conv2D, Int8) {
+  GPU gpu;
+
+  // A stride of 2, and partially packed words along x and along the weights.
+  const int input_dx = 7;
+  const int input_dy = 5;
+  const int input_channels = 3;
+  const int batch_size = 2;
+  Node input = Input(gpu, {input_dx, input_dy, input_channels, batch_size},
+                     /*training=*/false);
+  Node convolution =
+      Conv2D(input, /*kernel=*/3, /*channels=*/5, /*stride=*/2);
+
+  std::vector<std::vector<float>> examples(4);
+  for (int i = 0; i < examples.size(); ++i) {
+    for (int j = 0; j < input_dx * input_dy * input_channels; ++j) {
+      examples[i].push_back(std::sin(float(7 * i + j)));
+    }
+  }
+  auto predict = [&] {
+    return Predict()
+        .Input(input, [&](int i) { return std::span(examples[i]); })
+        .Output(convolution)
+        .Size(examples.size());
+  };
+
+  const std::vector<std::vector<float>> expected = predict().Execute();
+  predict().Quantize();
+  const std::vector<std::vector<float>> quantized = predict().Execute();
+  EXPECT_FALSE(convolution->weights[0].Buffer());
+
+  float max_value = 0.f;
+  for (const std::vector<float>& prediction : expected) {
+    for (float value : prediction) {
+      max_value = std::max(max_value, std::abs(value));
+    }
+  }
+  ASSERT_EQ(quantized.size(), expected.size());
+  for (int i = 0; i < expected.size(); ++i) {
+    ASSERT_EQ(quantized[i].size(), expected[i].size());
+    for (int j = 0; j < expected[i].size(); ++j) {
+      EXPECT_NEAR(quantized[i][j], expected[i][j], 0.05f * max_value);
+    }
+  }
+}
+
 TEST(Conv2D, MNIST) {
   // Load the MNIST dataset:
   auto mnist = mnist::read_dataset<std::vector, std::vector, float, uint8_t>(
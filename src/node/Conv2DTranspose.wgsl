@@ -14,16 +14,16 @@ const params_size = kernel_size * kernel_size * input_channels  * output_channel
 const output_size = output_dx   * output_dy   * output_channels * batch_size;
 
 // Input
-@group(0) @binding(0) var<storage, read_write> input: array<f32, input_size>;
-@group(0) @binding(1) var<storage, read_write> input_gradient: array<f32, input_size>;
+@group(0) @binding(0) var<storage, read_write> input: array<real, input_size>;
+@group(0) @binding(1) var<storage, read_write> input_gradient: array<real, input_size>;
 
 // Params
-@group(0) @binding(2) var<storage, read_write> weights: array<f32, params_size>;
-@group(0) @binding(3) var<storage, read_write> weights_gradient: array<f32, params_size>;
+@group(0) @binding(2) var<storage, read_write> weights: array<real, params_size>;
+@group(0) @binding(3) var<storage, read_write> weights_gradient: array<real, params_size>;
 
 // Output
-@group(0) @binding(4) var<storage, read_write> output: array<f32, output_size>;
-@group(0) @binding(5) var<storage, read_write> output_gradient: array<f32, output_size>;
+@group(0) @binding(4) var<storage, read_write> output: array<real, output_size>;
+@group(0) @binding(5) var<storage, read_write> output_gradient: array<real, output_size>;
 
 // Conv2D deconvolution:
 @compute @workgroup_size(8, 8, 1)
@@ -66,7 +66,7 @@ fn fn_output(@builtin(global_invocation_id) id: vec3<u32>) {
                            i_c + input_channels * (
                            o_c
         )));
-        sum += input[input_index] * weights[weight_index];
+        sum += f32(input[input_index]) * f32(weights[weight_index]);
       }
     }
   }
@@ -75,7 +75,7 @@ fn fn_output(@builtin(global_invocation_id) id: vec3<u32>) {
                      o_c + output_channels * (
                      b
   )));
-  output[output_index] = sum;
+  output[output_index] = real(sum);
 }
 
 @compute @workgroup_size(8, 8, 1)
@@ -108,7 +108,8 @@ fn fn_input_gradient(@builtin(global_invocation_id) id: vec3<u32>) {
                            o_c
         )));
 
-        sum += output_gradient[output_index] * weights[weight_index];
+        sum += f32(output_gradient[output_index]) *
+               f32(weights[weight_index]);
       }
     }
   }
@@ -117,7 +118,7 @@ fn fn_input_gradient(@builtin(global_invocation_id) id: vec3<u32>) {
                     i_c + input_channels * (
                     b
   )));
-  input_gradient[input_index] = sum;
+  input_gradient[input_index] = real(sum);
 }
 
 @compute @workgroup_size(8, 8, 1)
@@ -150,7 +151,7 @@ fn fn_weight_gradient(@builtin(global_invocation_id) id: vec3<u32>) {
                           i_c + input_channels * (
                           b
         )));
-        sum += output_gradient[output_index] * input[input_index];
+        sum += f32(output_gradient[output_index]) * f32(input[input_index]);
       }
     }
   }
@@ -160,5 +161,5 @@ fn fn_weight_gradient(@builtin(global_invocation_id) id: vec3<u32>) {
                      i_c + input_channels * (
                      o_c
   )));
-  weights_gradient[weight_index] = sum;
+  weights_gradient[weight_index] = real(sum);
 }
@@ -0,0 +1,269 @@
+const input_dx        : u32 = {};
+const input_dy        : u32 = {};
+const input_channels  : u32 = {};
+const output_channels : u32 = {};
+const batch_size      : u32 = {};
+
+// The number of channels computed by each invocation. The input tile is
+// transformed once and reused for all of them.
+const output_rc         : u32 = {};
+const input_gradient_rc : u32 = {};
+
+const output_dx = input_dx - 2;
+const output_dy = input_dy - 2;
+
+const input_size  = input_dx  * input_dy  * input_channels  * batch_size;
+const params_size = 9         * input_channels * output_channels;
+const output_size = output_dx * output_dy * output_channels * batch_size;
+
+// Input
+@group(0) @binding(0) var<storage, read_write> input: array<real, input_size>;
+@group(0) @binding(1) var<storage, read_write> input_gradient: array<real, input_size>;
+
+// Params
+@group(0) @binding(2) var<storage, read_write> weights: array<real, params_size>;
+
+// Output
+@group(0) @binding(3) var<storage, read_write> output: array<real, output_size>;
+@group(0) @binding(4) var<storage, read_write> output_gradient: array<real, output_size>;
+
+// The transformed weights U = G g G^T, 4x4 values per (i_c, o_c). Stored as
+// rows of 4 values along x, at 4 * (o_c + output_channels * i_c) + row.
+@group(0) @binding(5) var<storage, read_write> winograd_weights: array<vec4<f32>, 4 * input_channels * output_channels>;
+
+// Winograd F(2x2, 3x3)
+// --------------------
+// Specialization of Conv2D for 3x3 kernels with stride 1. Each 2x2 tile of
+// the output is computed from the 4x4 tile of the input covering it:
+//
+//   output = A^T [ sum_i_c (G g G^T) * (B^T d B) ] A
+//
+// where `*` is the elementwise product. This takes 16 multiplications per
+// (tile, i_c, o_c) instead of 36.
+//
+// The input gradient is the same convolution of the output gradient padded
+// by 2, with the kernel rotated by 180 degrees, and the channels swapped. The
+// rotation only permutes the transformed weights, so both reuse U.
+
+const tiles_output_x = (output_dx + 1) / 2;
+const tiles_output_y = (output_dy + 1) / 2;
+const tiles_output = tiles_output_x * tiles_output_y * batch_size;
+
+const tiles_input_x = (input_dx + 1) / 2;
+const tiles_input_y = (input_dy + 1) / 2;
+const tiles_input = tiles_input_x * tiles_input_y * batch_size;
+
+// G g for a row g of the kernel.
+fn kernel_row_transform(g: vec3<f32>) -> vec4<f32> {
+  return vec4<f32>(g.x,
+                   0.5 * (g.x + g.y + g.z),
+                   0.5 * (g.x - g.y + g.z),
+                   g.z);
+}
+
+// B^T d for a row d of the input tile.
+fn input_row_transform(d: vec4<f32>) -> vec4<f32> {
+  return vec4<f32>(d.x - d.z, d.y + d.z, d.z - d.y, d.y - d.w);
+}
+
+// A^T m for a row m of the product.
+fn output_row_transform(m: vec4<f32>) -> vec2<f32> {
+  return vec2<f32>(m.x + m.y + m.z, m.y - m.z - m.w);
+}
+
+// B^T d B, the transform along x then along y.
+fn input_transform(d: array<vec4<f32>, 4>) -> array<vec4<f32>, 4> {
+  let r0 = input_row_transform(d[0]);
+  let r1 = input_row_transform(d[1]);
+  let r2 = input_row_transform(d[2]);
+  let r3 = input_row_transform(d[3]);
+  return array<vec4<f32>, 4>(r0 - r2, r1 + r2, r2 - r1, r1 - r3);
+}
+
+// A^T m A, the transform along x then along y.
+fn output_transform(m: array<vec4<f32>, 4>) -> array<vec2<f32>, 2> {
+  let q0 = output_row_transform(m[0]);
+  let q1 = output_row_transform(m[1]);
+  let q2 = output_row_transform(m[2]);
+  let q3 = output_row_transform(m[3]);
+  return array<vec2<f32>, 2>(q0 + q1 + q2, q1 - q2 - q3);
+}
+
+// 4 values of the input, starting at (x, y). Zero outside of the input.
+fn input_row(x: u32, y: u32, i_c: u32, b: u32) -> vec4<f32> {
+  var row = vec4<f32>(0.0);
+  if (y >= input_dy) {
+    return row;
+  }
+  let base = input_dx * (y + input_dy * (i_c + input_channels * b));
+  for (var u = 0u; u < 4; u++) {
+    if (x + u < input_dx) {
+      row[u] = f32(input[base + x + u]);
+    }
+  }
+  return row;
+}
+
+// 4 values of the output gradient, starting at (x, y). Zero outside of the
+// output gradient, which also pads it.
+fn output_gradient_row(x: i32, y: i32, o_c: u32, b: u32) -> vec4<f32> {
+  var row = vec4<f32>(0.0);
+  if (y < 0 || y >= i32(output_dy)) {
+    return row;
+  }
+  let base = output_dx * (u32(y) + output_dy * (o_c + output_channels * b));
+  for (var u = 0; u < 4; u++) {
+    if (x + u >= 0 && x + u < i32(output_dx)) {
+      row[u] = f32(output_gradient[base + u32(x + u)]);
+    }
+  }
+  return row;
+}
+
+// Computes U for every (i_c, o_c). This runs once per step, in the forward
+// pass, and the backward pass reuses it. The weights only change in between,
+// when the optimizer updates them. Inference runs it once per prediction.
+@compute @workgroup_size(64, 1, 1)
+fn fn_weights_transform(@builtin(global_invocation_id) id: vec3<u32>,
+                        @builtin(num_workgroups) num_workgroups: vec3<u32>) {
+  let i = flat_index(id, num_workgroups, 64);
+  let o_c = i % output_channels;
+  let i_c = i / output_channels;
+  if (i_c >= input_channels) {
+    return;
+  }
+
+  let base = 9 * (i_c + input_channels * o_c);
+  var t: array<vec4<f32>, 3>;
+  for (var w_y = 0u; w_y < 3; w_y++) {
+    t[w_y] = kernel_row_transform(vec3<f32>(f32(weights[base + 3 * w_y + 0]),
+                                            f32(weights[base + 3 * w_y + 1]),
+                                            f32(weights[base + 3 * w_y + 2])));
+  }
+
+  let index = 4 * (o_c + output_channels * i_c);
+  winograd_weights[index + 0] = t[0];
+  winograd_weights[index + 1] = 0.5 * (t[0] + t[1] + t[2]);
+  winograd_weights[index + 2] = 0.5 * (t[0] - t[1] + t[2]);
+  winograd_weights[index + 3] = t[2];
+}
+
+// One invocation per output tile and group of `output_rc` output channels,
+// the tiles first. See NodePipeline::RunFlat().
+@compute @workgroup_size(64, 1, 1)
+fn fn_output(@builtin(global_invocation_id) id: vec3<u32>,
+             @builtin(num_workgroups) num_workgroups: vec3<u32>) {
+  const rc = output_rc;
+  let i = flat_index(id, num_workgroups, 64);
+  if (i >= tiles_output * ((output_channels + rc - 1) / rc)) {
+    return;
+  }
+  let tile = i % tiles_output;
+  let t_x = tile % tiles_output_x;
+  let t_y = (tile / tiles_output_x) % tiles_output_y;
+  let b = tile / (tiles_output_x * tiles_output_y);
+
+  let o_c0 = (i / tiles_output) * rc;
+
+  var m: array<array<vec4<f32>, 4>, rc>;
+  for (var i_c = 0u; i_c < input_channels; i_c++) {
+    let v = input_transform(array<vec4<f32>, 4>(
+        input_row(2 * t_x, 2 * t_y + 0, i_c, b),
+        input_row(2 * t_x, 2 * t_y + 1, i_c, b),
+        input_row(2 * t_x, 2 * t_y + 2, i_c, b),
+        input_row(2 * t_x, 2 * t_y + 3, i_c, b)));
+    for (var r = 0u; r < rc; r++) {
+      let o_c = o_c0 + r;
+      if (o_c >= output_channels) {
+        break;
+      }
+      let index = 4 * (o_c + output_channels * i_c);
+      for (var row = 0u; row < 4; row++) {
+        m[r][row] += winograd_weights[index + row] * v[row];
+      }
+    }
+  }
+
+  for (var r = 0u; r < rc; r++) {
+    let o_c = o_c0 + r;
+    if (o_c >= output_channels) {
+      break;
+    }
+    let y = output_transform(m[r]);
+    for (var f = 0u; f < 2; f++) {
+      for (var e = 0u; e < 2; e++) {
+        let o_x = 2 * t_x + e;
+        let o_y = 2 * t_y + f;
+        if (o_x < output_dx && o_y < output_dy) {
+          output[o_x + output_dx * (
+                 o_y + output_dy * (
+                 o_c + output_channels * (
+                 b
+          )))] = real(y[f][e]);
+        }
+      }
+    }
+  }
+}
+
+// One invocation per input tile and group of `input_gradient_rc` input
+// channels, the tiles first. See NodePipeline::RunFlat().
+@compute @workgroup_size(64, 1, 1)
+fn fn_input_gradient(@builtin(global_invocation_id) id: vec3<u32>,
+                     @builtin(num_workgroups) num_workgroups: vec3<u32>) {
+  const rc = input_gradient_rc;
+  let i = flat_index(id, num_workgroups, 64);
+  if (i >= tiles_input * ((input_channels + rc - 1) / rc)) {
+    return;
+  }
+  let tile = i % tiles_input;
+  let t_x = tile % tiles_input_x;
+  let t_y = (tile / tiles_input_x) % tiles_input_y;
+  let b = tile / (tiles_input_x * tiles_input_y);
+
+  let i_c0 = (i / tiles_input) * rc;
+
+  let x = i32(2 * t_x) - 2;
+  let y = i32(2 * t_y) - 2;
+  var m: array<array<vec4<f32>, 4>, rc>;
+  for (var o_c = 0u; o_c < output_channels; o_c++) {
+    let v = input_transform(array<vec4<f32>, 4>(
+        output_gradient_row(x, y + 0, o_c, b),
+        output_gradient_row(x, y + 1, o_c, b),
+        output_gradient_row(x, y + 2, o_c, b),
+        output_gradient_row(x, y + 3, o_c, b)));
+    for (var r = 0u; r < rc; r++) {
+      let i_c = i_c0 + r;
+      if (i_c >= input_channels) {
+        break;
+      }
+      // Rotating the kernel swaps the first and last rows and columns of U.
+      let index = 4 * (o_c + output_channels * i_c);
+      m[r][0] += winograd_weights[index + 3].wyzx * v[0];
+      m[r][1] += winograd_weights[index + 1].wyzx * v[1];
+      m[r][2] += winograd_weights[index + 2].wyzx * v[2];
+      m[r][3] += winograd_weights[index + 0].wyzx * v[3];
+    }
+  }
+
+  for (var r = 0u; r < rc; r++) {
+    let i_c = i_c0 + r;
+    if (i_c >= input_channels) {
+      break;
+    }
+    let g = output_transform(m[r]);
+    for (var f = 0u; f < 2; f++) {
+      for (var e = 0u; e < 2; e++) {
+        let i_x = 2 * t_x + e;
+        let i_y = 2 * t_y + f;
+        if (i_x < input_dx && i_y < input_dy) {
+          input_gradient[i_x + input_dx * (
+                         i_y + input_dy * (
+                         i_c + input_channels * (
+                         b
+          )))] = real(g[f][e]);
+        }
+      }
+    }
+  }
+}
@@ -1,12 +1,13 @@
 #include "Node.hpp"
 #include "Tensor.hpp"
 
-Node Input(GPU& gpu, std::vector<int> sizes) {
+Node Input(GPU& gpu, std::vector<int> sizes, bool training) {
   class Impl : public NodeImpl {
    public:
     std::string Name() override { return "Input"; }
 
-    Impl(GPU& gpu, std::vector<int> sizes) : NodeImpl(gpu) {
+    Impl(GPU& gpu, std::vector<int> sizes, bool training) : NodeImpl(gpu) {
+      training_ = training;
       outputs = {
         Tensor(sizes)
       };
@@ -17,7 +18,9 @@ Node Input(GPU& gpu, std::vector<int> sizes) {
         Tensor(sizes)
       };
       outputs_gradients[0].SetName("Input outputs_gradients[0]");
-      outputs_gradients[0].Fill(gpu, 0.f);
+      if (training) {
+        outputs_gradients[0].Fill(gpu, 0.f);
+      }
     }
 
     void Forward() override {
@@ -28,5 +31,5 @@ Node Input(GPU& gpu, std::vector<int> sizes) {
       // Do nothing.
     }
   };
-  return std::make_shared<Impl>(gpu, sizes);
+  return std::make_shared<Impl>(gpu, sizes, training);
 }
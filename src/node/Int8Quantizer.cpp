@@ -0,0 +1,92 @@
+#include "node/Int8Quantizer.hpp"
+
+#include <algorithm>
+#include <assert.hpp>
+#include <bit>
+#include <cmath>
+#include "Shader.hpp"
+#include "fmt/format.h"
+#include "node/Int8Quantizer.wgsl.hpp"
+
+Int8Quantizer::Int8Quantizer(GPU& gpu, Tensor& input, int row_size)
+    : gpu_(gpu),
+      float_input_(input),
+      row_size_(row_size),
+      rows_(input.TotalSize() / row_size),
+      pipeline_(gpu) {}
+
+void Int8Quantizer::StartCalibration() {
+  range_.SetName("Int8Quantizer range");
+  range_.SetFullPrecision(true);
+  range_.Fill(gpu_, 0.f);
+
+  input = Tensor({rows_ * ((row_size_ + 3) / 4)});
+  input.SetName("Int8Quantizer input");
+  input.SetTransient(true);
+  input.SetFullPrecision(true);
+
+  wgpu::ShaderModule module =
+      Shader(gpu_, fmt::format(wgsl::Int8Quantizer,       //
+                               float_input_.TotalSize(),  //
+                               row_size_));
+  pipeline_.Init(module, {
+                             &float_input_,
+                             &range_,
+                             &input,
+                         });
+  calibrating_ = true;
+}
+
+void Int8Quantizer::Calibrate() {
+  pipeline_.RunFlat("fn_calibrate", float_input_.TotalSize(), 256);
+}
+
+void Int8Quantizer::Quantize(Tensor& float_weights, int weight_row_size) {
+  ASSERT(calibrating_, "The input must be calibrated first.");
+  calibrating_ = false;
+  quantized_ = true;
+
+  // The input scale must match fn_quantize.
+  const float input_scale = std::max(range_.Read(gpu_)[0], 1e-30f) / 127.f;
+
+  const std::vector<float> values = float_weights.Read(gpu_);
+  const int channels = values.size() / weight_row_size;
+  const int row_words = (weight_row_size + 3) / 4;
+
+  // The packed words are written as the f32 with the same bits.
+  std::vector<float> words(channels * row_words);
+  std::vector<float> channel_scales(channels);
+  for (int c = 0; c < channels; ++c) {
+    auto row = values.begin() + c * weight_row_size;
+    float max_value = 0.f;
+    for (int k = 0; k < weight_row_size; ++k) {
+      max_value = std::max(max_value, std::abs(row[k]));
+    }
+    const float weight_scale = max_value > 0.f ? max_value / 127.f : 1.f;
+    channel_scales[c] = input_scale * weight_scale;
+
+    for (int word = 0; word < row_words; ++word) {
+      uint32_t packed = 0;
+      for (int u = 0; u < 4 && 4 * word + u < weight_row_size; ++u) {
+        const float q = std::clamp(std::round(row[4 * word + u] / weight_scale),
+                                   -127.f, 127.f);
+        packed |= (uint32_t(int32_t(q)) & 0xff) << (8 * u);
+      }
+      words[c * row_words + word] = std::bit_cast<float>(packed);
+    }
+  }
+
+  input.Fill(gpu_, 0.f);
+  weights = Tensor({channels * row_words});
+  weights.SetName("Int8Quantizer weights");
+  weights.SetFullPrecision(true);
+  weights.Write(gpu_, words);
+  scales = Tensor({channels});
+  scales.SetName("Int8Quantizer scales");
+  scales.SetFullPrecision(true);
+  scales.Write(gpu_, channel_scales);
+}
+
+void Int8Quantizer::QuantizeInput() {
+  pipeline_.RunFlat("fn_quantize", input.TotalSize(), 256);
+}
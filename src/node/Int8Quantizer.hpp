@@ -0,0 +1,56 @@
+#ifndef NEURAL_WEBGPU_INT8_QUANTIZER_HPP_
+#define NEURAL_WEBGPU_INT8_QUANTIZER_HPP_
+
+#include "Tensor.hpp"
+#include "node/NodePipeline.hpp"
+
+// Post-training int8 quantization of the input and the weights of a node, used
+// by Linear and Conv2D. See Predict::Quantize().
+//
+// A value x is stored as the int8 round(x / scale), and 4 of them are packed
+// in a u32, for dot4_i8(). The input has a single scale, from the largest
+// magnitude seen during the calibration. The weights have one scale per
+// output channel.
+class Int8Quantizer {
+ public:
+  // `input` is made of rows of `row_size` values. Each row is packed in
+  // (row_size + 3) / 4 u32, padded with zeros.
+  Int8Quantizer(GPU& gpu, Tensor& input, int row_size);
+
+  // Start measuring the range of the input. Then, Calibrate() is called after
+  // every forward pass.
+  void StartCalibration();
+  void Calibrate();
+  bool calibrating() const { return calibrating_; }
+
+  // Convert `weights`, made of one row of `weight_row_size` values per output
+  // channel, using the range measured by the calibration. Each row is packed
+  // in (weight_row_size + 3) / 4 u32.
+  void Quantize(Tensor& weights, int weight_row_size);
+  bool quantized() const { return quantized_; }
+
+  // Quantize the input into `input`. Called at every forward pass, once
+  // quantized.
+  void QuantizeInput();
+
+  // The packed int8 values.
+  Tensor input{{1}};
+  Tensor weights{{1}};
+
+  // input_scale * weight_scale, for every output channel. The sums of the
+  // int8 products are multiplied by them.
+  Tensor scales{{1}};
+
+ private:
+  GPU& gpu_;
+  Tensor& float_input_;
+  const int row_size_;
+  const int rows_;
+  bool calibrating_ = false;
+  bool quantized_ = false;
+
+  Tensor range_{{1}};
+  NodePipeline pipeline_;
+};
+
+#endif  // NEURAL_WEBGPU_INT8_QUANTIZER_HPP_
@@ -0,0 +1,61 @@
+// The input is made of rows of `row_size` values.
+const size     : u32 = {};
+const row_size : u32 = {};
+
+// Each row is quantized into `row_words` u32, of 4 int8 values each. The last
+// one is padded with zeros.
+const rows      = size / row_size;
+const row_words = (row_size + 3) / 4;
+
+@group(0) @binding(0) var<storage, read_write> input: array<real, size>;
+
+// The largest magnitude of the input seen during the calibration, as the bits
+// of a f32. Non-negative f32 are ordered like their bits.
+@group(0) @binding(1) var<storage, read_write> input_range: atomic<u32>;
+
+@group(0) @binding(2) var<storage, read_write> quantized_input: array<u32, rows * row_words>;
+
+var<workgroup> workgroup_range: atomic<u32>;
+
+@compute @workgroup_size(256, 1, 1)
+fn fn_calibrate(@builtin(global_invocation_id) id: vec3<u32>,
+                @builtin(num_workgroups) num_workgroups: vec3<u32>,
+                @builtin(local_invocation_index) local: u32) {
+  let i = flat_index(id, num_workgroups, 256);
+  if (i < size) {
+    atomicMax(&workgroup_range, bitcast<u32>(abs(f32(input[i]))));
+  }
+  workgroupBarrier();
+
+  if (local == 0) {
+    atomicMax(&input_range, atomicLoad(&workgroup_range));
+  }
+}
+
+// Rounds to the nearest int8, and packs them, x in the lowest byte.
+fn pack_int8(values: vec4<f32>) -> u32 {
+  let q = bitcast<vec4<u32>>(vec4<i32>(round(clamp(values, vec4(-127.0),
+                                                   vec4(127.0)))));
+  return (q.x & 0xffu) | ((q.y & 0xffu) << 8) | ((q.z & 0xffu) << 16) |
+         (q.w << 24);
+}
+
+@compute @workgroup_size(256, 1, 1)
+fn fn_quantize(@builtin(global_invocation_id) id: vec3<u32>,
+               @builtin(num_workgroups) num_workgroups: vec3<u32>) {
+  let word = flat_index(id, num_workgroups, 256);
+  if (word >= rows * row_words) {
+    return;
+  }
+  let row = word / row_words;
+  let column = 4 * (word % row_words);
+
+  let scale = 127.0 / max(bitcast<f32>(atomicLoad(&input_range)), 1e-30);
+  var values = vec4<f32>(0.0);
+  for (var u = 0u; u < 4; u++) {
+    if (column + u < row_size) {
+      values[u] = f32(input[column + u + row_size * row]) * scale;
+    }
+  }
+  quantized_input[word] = pack_int8(values);
+}
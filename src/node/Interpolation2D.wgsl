@@ -13,12 +13,12 @@ const scale_x_inv : f32 = f32(input_dx) / f32(output_dx);
 const scale_y_inv : f32 = f32(input_dy) / f32(output_dy);
 
 // Input
-@group(0) @binding(0) var<storage, read_write> input: array<f32, input_size>;
-@group(0) @binding(1) var<storage, read_write> input_gradient: array<f32, input_size>;
+@group(0) @binding(0) var<storage, read_write> input: array<real, input_size>;
+@group(0) @binding(1) var<storage, read_write> input_gradient: array<real, input_size>;
 
 // Output
-@group(0) @binding(2) var<storage, read_write> output: array<f32, output_size>;
-@group(0) @binding(3) var<storage, read_write> output_gradient: array<f32, output_size>;
+@group(0) @binding(2) var<storage, read_write> output: array<real, output_size>;
+@group(0) @binding(3) var<storage, read_write> output_gradient: array<real, output_size>;
 
 @compute @workgroup_size(8,8,1)
 fn fn_output(@builtin(global_invocation_id) id: vec3<u32>) {
@@ -39,10 +39,10 @@ fn fn_output(@builtin(global_invocation_id) id: vec3<u32>) {
   let dx = i_x_f - f32(i_x);
   let dy = i_y_f - f32(i_y);
 
-  let i_00 = input[i_x + input_dx * (i_y + input_dy * b)];
-  let i_01 = input[i_x + 1 + input_dx * (i_y + input_dy * b)];
-  let i_10 = input[i_x + input_dx * (i_y + 1 + input_dy * b)];
-  let i_11 = input[i_x + 1 + input_dx * (i_y + 1 + input_dy * b)];
+  let i_00 = f32(input[i_x + input_dx * (i_y + input_dy * b)]);
+  let i_01 = f32(input[i_x + 1 + input_dx * (i_y + input_dy * b)]);
+  let i_10 = f32(input[i_x + input_dx * (i_y + 1 + input_dy * b)]);
+  let i_11 = f32(input[i_x + 1 + input_dx * (i_y + 1 + input_dy * b)]);
 
   let interpolation = mix(
     mix(i_00, i_01, dx),
@@ -52,7 +52,7 @@ fn fn_output(@builtin(global_invocation_id) id: vec3<u32>) {
   let output_index = o_x + output_dx * (
                      o_y + output_dy * (
                      b));
-  output[output_index] = interpolation;
+  output[output_index] = real(interpolation);
 }
 
 @compute @workgroup_size(8, 8, 1)
@@ -73,10 +73,10 @@ fn fn_input_gradient(@builtin(global_invocation_id) id: vec3<u32>) {
   let dx = o_x_f - f32(o_x);
   let dy = o_y_f - f32(o_y);
 
-  let o_00 = output[o_x     + output_dx * (o_y     + output_dy * b)];
-  let o_01 = output[o_x + 1 + output_dx * (o_y     + output_dy * b)];
-  let o_10 = output[o_x     + output_dx * (o_y + 1 + output_dy * b)];
-  let o_11 = output[o_x + 1 + output_dx * (o_y + 1 + output_dy * b)];
+  let o_00 = f32(output[o_x     + output_dx * (o_y     + output_dy * b)]);
+  let o_01 = f32(output[o_x + 1 + output_dx * (o_y     + output_dy * b)]);
+  let o_10 = f32(output[o_x     + output_dx * (o_y + 1 + output_dy * b)]);
+  let o_11 = f32(output[o_x + 1 + output_dx * (o_y + 1 + output_dy * b)]);
 
   let interpolation = mix(
     mix(o_00, o_01, dx),
@@ -88,5 +88,5 @@ fn fn_input_gradient(@builtin(global_invocation_id) id: vec3<u32>) {
                     i_y + input_dy * (
                     b
                   ));
-  input_gradient[input_index] = interpolation;
+  input_gradient[input_index] = real(interpolation);
 }
@@ -1,9 +1,13 @@
+#include <assert.hpp>
+
 #include "Node.hpp"
 #include "Shader.hpp"
 #include "Tensor.hpp"
 #include "fmt/format.h"
+#include "node/Int8Quantizer.hpp"
 #include "node/NodePipeline.hpp"
 #include "node/Linear.wgsl.hpp"
+#include "node/Tiling.hpp"
 
 #include <iostream>
 
@@ -16,7 +20,26 @@ Node Linear(Node input, std::vector<int> output_sizes) {
     int input_size_;
     int output_size_;
 
-    Impl(Node input, std::vector<int> output_sizes) : NodeImpl(input) {
+    // Matrix multiplications, as [M][N] = [M][K] x [K][N]:
+    // - Output:          [batch][output] x [input].
+    // - Input gradient:  [batch][input] x [output].
+    // - Weight gradient: [output][input] x [batch].
+    Tiling output_tiling_{1, 1};
+    Tiling input_gradient_tiling_{1, 1};
+    Tiling weights_gradient_tiling_{1, 1};
+    int weights_gradient_splits_;
+    int weights_gradient_chunk_;
+    Tensor weights_gradient_partial_{{1}};
+
+    // The rows of the matrices are [batch][input] and [output][input].
+    Int8Quantizer quantizer_;
+
+    Impl(Node input, std::vector<int> output_sizes)
+        : NodeImpl(input),
+          quantizer_(gpu(),
+                     input->outputs[0],
+                     input->outputs[0].TotalSize() /
+                         input->outputs[0].BatchSize()) {
       float output_size = 1;
       for (int i = 0; i < output_sizes.size(); i++) {
         output_size *= output_sizes[i];
@@ -43,9 +66,44 @@ Node Linear(Node input, std::vector<int> output_sizes) {
 
       SetupGradients();
 
-      wgpu::ShaderModule module = Shader(
-          gpu(),
-          fmt::format(wgsl::Linear, input_size_, output_size_, batch_size_));
+      output_tiling_ = Tiling(batch_size_, output_size_);
+      input_gradient_tiling_ = Tiling(batch_size_, input_size_);
+      weights_gradient_tiling_ = Tiling(output_size_, input_size_);
+      // Linear.wgsl doesn't fold the rows of tiles into z, see Tiling.
+      ASSERT(output_tiling_.groups_z == 1 &&
+                 input_gradient_tiling_.groups_z == 1 &&
+                 weights_gradient_tiling_.groups_z == 1,
+             "Linear: the matrices are too large.");
+      weights_gradient_chunk_ =
+          SplitChunk(batch_size_, weights_gradient_tiling_);
+      weights_gradient_splits_ =
+          (batch_size_ + weights_gradient_chunk_ - 1) / weights_gradient_chunk_;
+
+      weights_gradient_partial_ = Tensor({
+          weights_gradient_splits_ > 1
+              ? input_size_ * output_size_ * weights_gradient_splits_
+              : 1,
+      });
+      weights_gradient_partial_.SetTransient(true);
+      weights_gradient_partial_.SetFullPrecision(true);
+      // Inference-only nodes don't need the partial sums.
+      if (training()) {
+        weights_gradient_partial_.Fill(gpu(), 0.f);
+      }
+
+      wgpu::ShaderModule module =
+          Shader(gpu(), fmt::format(wgsl::Linear,                 //
+                                    input_size_,                  //
+                                    output_size_,                 //
+                                    batch_size_,                  //
+                                    output_tiling_.rm,            //
+                                    output_tiling_.rn,            //
+                                    input_gradient_tiling_.rm,    //
+                                    input_gradient_tiling_.rn,    //
+                                    weights_gradient_tiling_.rm,  //
+                                    weights_gradient_tiling_.rn,  //
+                                    weights_gradient_splits_,     //
+                                    weights_gradient_chunk_));
 
       pipeline_.Init(module, {
                                  &input->outputs[0],
@@ -56,24 +114,62 @@ Node Linear(Node input, std::vector<int> output_sizes) {
                                  &weights_gradients[1],
                                  &outputs[0],
                                  &outputs_gradients[0],
+                                 &weights_gradient_partial_,
+                                 &quantizer_.input,
+                                 &quantizer_.weights,
+                                 &quantizer_.scales,
                              });
     }
 
     void Forward() override {
-      pipeline_.Run("fn_output",                           //
-                    output_size_, (batch_size_ + 63) / 64  //
+      pipeline_.Run("fn_output",               //
+                    output_tiling_.groups_x,  //
+                    output_tiling_.groups_y   //
       );
     }
+
+    void ForwardInference() override {
+      if (quantizer_.quantized()) {
+        quantizer_.QuantizeInput();
+        pipeline_.Run("fn_output_int8",         //
+                      output_tiling_.groups_x,  //
+                      output_tiling_.groups_y   //
+        );
+        return;
+      }
+      Forward();
+      if (quantizer_.calibrating()) {
+        quantizer_.Calibrate();
+      }
+    }
+
+    void StartCalibration() override {
+      ASSERT(!training(), "Only inference-only nodes can be quantized.");
+      quantizer_.StartCalibration();
+    }
+
+    // The float weights aren't used anymore.
+    void Quantize() override {
+      quantizer_.Quantize(weights[0], input_size_);
+      weights[0] = Tensor(weights[0].sizes());
+    }
+
     void Backward() override {
-      pipeline_.Run("fn_input_gradient",     //
-                    input_size_,             //
-                    (batch_size_ + 63) / 64  //
+      pipeline_.Run("fn_input_gradient",               //
+                    input_gradient_tiling_.groups_x,  //
+                    input_gradient_tiling_.groups_y   //
       );
 
-      pipeline_.Run("fn_weights_gradient",  //
-                    (input_size_ + 7) / 8,  //
-                    (output_size_ + 7) / 8  //
+      pipeline_.Run("fn_weights_gradient",               //
+                    weights_gradient_tiling_.groups_x,  //
+                    weights_gradient_tiling_.groups_y,  //
+                    weights_gradient_splits_            //
       );
+      if (weights_gradient_splits_ > 1) {
+        pipeline_.Run("fn_weights_gradient_reduce",           //
+                      (input_size_ * output_size_ + 63) / 64  //
+        );
+      }
 
       pipeline_.Run("fn_bias_gradient",       //
                     (output_size_ + 63) / 64  //
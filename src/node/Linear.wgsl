@@ -3,77 +3,342 @@ const y_size : u32 = {};
 const batch_size : u32 = {};
 
 // Input
-@group(0) @binding(0) var<storage, read_write> input: array<f32, x_size * batch_size>;
-@group(0) @binding(1) var<storage, read_write> input_gradient: array<f32, x_size * batch_size>;
+@group(0) @binding(0) var<storage, read_write> input: array<real, x_size * batch_size>;
+@group(0) @binding(1) var<storage, read_write> input_gradient: array<real, x_size * batch_size>;
 
 // Weights
-@group(0) @binding(2) var<storage, read_write> weights: array<f32, x_size * y_size>;
-@group(0) @binding(3) var<storage, read_write> bias: array<f32, y_size>;
-@group(0) @binding(4) var<storage, read_write> weights_gradient: array<f32, x_size * y_size>;
-@group(0) @binding(5) var<storage, read_write> bias_gradient: array<f32, y_size>;
+@group(0) @binding(2) var<storage, read_write> weights: array<real, x_size * y_size>;
+@group(0) @binding(3) var<storage, read_write> bias: array<real, y_size>;
+@group(0) @binding(4) var<storage, read_write> weights_gradient: array<real, x_size * y_size>;
+@group(0) @binding(5) var<storage, read_write> bias_gradient: array<real, y_size>;
 
 // Output
-@group(0) @binding(6) var<storage, read_write> output: array<f32, y_size * batch_size>;
-@group(0) @binding(7) var<storage, read_write> output_gradient: array<f32, y_size * batch_size>;
+@group(0) @binding(6) var<storage, read_write> output: array<real, y_size * batch_size>;
+@group(0) @binding(7) var<storage, read_write> output_gradient: array<real, y_size * batch_size>;
 
-@compute @workgroup_size(1, 64, 1)
-fn fn_output(@builtin(global_invocation_id) id: vec3<u32>) {
-    let y = id.x;
-    let batch = id.y;
-    if (y >= y_size || batch >= batch_size) {
-        return;
+// Partial sums of the weights gradient, one per split of the batch. See
+// fn_weights_gradient.
+@group(0) @binding(8) var<storage, read_write> weights_gradient_partial: array<f32>;
+
+// Int8 quantization, see Int8Quantizer.hpp. The input and the weights are
+// packed by 4 values along x, and scaled per output by `scales`.
+const x_words = (x_size + 3) / 4;
+@group(0) @binding(9) var<storage, read_write> quantized_input: array<u32, x_words * batch_size>;
+@group(0) @binding(10) var<storage, read_write> quantized_weights: array<u32, x_words * y_size>;
+@group(0) @binding(11) var<storage, read_write> scales: array<f32, y_size>;
+
+// Matrix multiplications C[M][N] = sum_k A[M][k] * B[k][N]
+// ----------------------------------------------------------
+// A workgroup of 16x16 invocations computes a tile of C of (16*rm)x(16*rn)
+// values. Each invocation keeps a rm x rn block of C in registers, and
+// computes the rows ly + 16*i and the columns lx + 16*j of the tile.
+//
+// The tiles of A and B are staged in workgroup memory, tile_k values of the
+// reduced dimension at a time. They are stored as [k][m] and [k][n].
+//
+// The register tile sizes are chosen per matrix shape, see Tiling.hpp.
+const output_rm : u32 = {};
+const output_rn : u32 = {};
+const input_gradient_rm : u32 = {};
+const input_gradient_rn : u32 = {};
+const weights_gradient_rm : u32 = {};
+const weights_gradient_rn : u32 = {};
+const weights_gradient_splits : u32 = {};
+const weights_gradient_chunk : u32 = {};
+
+const tile_k = 16u;
+const tile_max = 64u;
+var<workgroup> tile_a: array<f32, tile_k * tile_max>;
+var<workgroup> tile_b: array<f32, tile_k * tile_max>;
+var<workgroup> tile_a_int8: array<u32, tile_k * tile_max>;
+var<workgroup> tile_b_int8: array<u32, tile_k * tile_max>;
+
+// output[batch][y] = sum_x input[batch][x] * weights[y][x] + bias[y]
+//   M = batch_size, N = y_size, K = x_size.
+@compute @workgroup_size(16, 16, 1)
+fn fn_output(@builtin(workgroup_id) group: vec3<u32>,
+             @builtin(local_invocation_id) local: vec3<u32>,
+             @builtin(local_invocation_index) index: u32) {
+  const rm = output_rm;
+  const rn = output_rn;
+  const tm = 16 * rm;
+  const tn = 16 * rn;
+  let m0 = group.y * tm;
+  let n0 = group.x * tn;
+
+  var sum: array<f32, rm * rn>;
+  for (var k0 = 0u; k0 < x_size; k0 += tile_k) {
+    // Both matrices are contiguous along k.
+    for (var i = index; i < tm * tile_k; i += 256) {
+      let k = i % tile_k;
+      let m = i / tile_k;
+      var value = 0.0;
+      if (m0 + m < batch_size && k0 + k < x_size) {
+        value = f32(input[(k0 + k) + x_size * (m0 + m)]);
+      }
+      tile_a[k * tm + m] = value;
     }
+    for (var i = index; i < tn * tile_k; i += 256) {
+      let k = i % tile_k;
+      let n = i / tile_k;
+      var value = 0.0;
+      if (n0 + n < y_size && k0 + k < x_size) {
+        value = f32(weights[(k0 + k) + x_size * (n0 + n)]);
+      }
+      tile_b[k * tn + n] = value;
+    }
+    workgroupBarrier();
 
-    var x_index = 0 + x_size * batch;
-    let y_index = y + y_size * batch;
-    var w_index = 0 + x_size * y;
-    var sum : f32 = 0.f;
-    for (var i = 0u; i < x_size; i++) {
-        sum += input[x_index] * weights[w_index];
-        x_index++;
-        w_index++;
+    for (var k = 0u; k < tile_k; k++) {
+      var a: array<f32, rm>;
+      var b: array<f32, rn>;
+      for (var i = 0u; i < rm; i++) {
+        a[i] = tile_a[k * tm + local.y + 16 * i];
+      }
+      for (var j = 0u; j < rn; j++) {
+        b[j] = tile_b[k * tn + local.x + 16 * j];
+      }
+      for (var i = 0u; i < rm; i++) {
+        for (var j = 0u; j < rn; j++) {
+          sum[i * rn + j] += a[i] * b[j];
+        }
+      }
     }
+    workgroupBarrier();
+  }
 
-    output[y_index] = sum + bias[y];
+  for (var i = 0u; i < rm; i++) {
+    for (var j = 0u; j < rn; j++) {
+      let m = m0 + local.y + 16 * i;
+      let n = n0 + local.x + 16 * j;
+      if (m < batch_size && n < y_size) {
+        output[n + y_size * m] = real(sum[i * rn + j] + f32(bias[n]));
+      }
+    }
+  }
 }
 
-@compute @workgroup_size(1, 64, 1)
-fn fn_input_gradient(@builtin(global_invocation_id) id: vec3<u32>) {
-    let x = id.x;
-    let batch = id.y;
-    if (x >= x_size || batch >= batch_size) {
-        return;
+// The same as fn_output, with int8 input and weights. Each k is a word of 4
+// values along x, and the sums are exact.
+//   M = batch_size, N = y_size, K = x_words.
+@compute @workgroup_size(16, 16, 1)
+fn fn_output_int8(@builtin(workgroup_id) group: vec3<u32>,
+                  @builtin(local_invocation_id) local: vec3<u32>,
+                  @builtin(local_invocation_index) index: u32) {
+  const rm = output_rm;
+  const rn = output_rn;
+  const tm = 16 * rm;
+  const tn = 16 * rn;
+  let m0 = group.y * tm;
+  let n0 = group.x * tn;
+
+  var sum: array<i32, rm * rn>;
+  for (var k0 = 0u; k0 < x_words; k0 += tile_k) {
+    // Both matrices are contiguous along k.
+    for (var i = index; i < tm * tile_k; i += 256) {
+      let k = i % tile_k;
+      let m = i / tile_k;
+      var value = 0u;
+      if (m0 + m < batch_size && k0 + k < x_words) {
+        value = quantized_input[(k0 + k) + x_words * (m0 + m)];
+      }
+      tile_a_int8[k * tm + m] = value;
     }
+    for (var i = index; i < tn * tile_k; i += 256) {
+      let k = i % tile_k;
+      let n = i / tile_k;
+      var value = 0u;
+      if (n0 + n < y_size && k0 + k < x_words) {
+        value = quantized_weights[(k0 + k) + x_words * (n0 + n)];
+      }
+      tile_b_int8[k * tn + n] = value;
+    }
+    workgroupBarrier();
 
-    let x_index = x + x_size * batch;
-    var w_index = x;
-    var sum : f32 = 0.0;
-    for (var i = 0u; i < y_size; i++) {
-        sum += output_gradient[i + y_size * batch] * weights[w_index];
-        w_index += x_size;
+    for (var k = 0u; k < tile_k; k++) {
+      var a: array<u32, rm>;
+      var b: array<u32, rn>;
+      for (var i = 0u; i < rm; i++) {
+        a[i] = tile_a_int8[k * tm + local.y + 16 * i];
+      }
+      for (var j = 0u; j < rn; j++) {
+        b[j] = tile_b_int8[k * tn + local.x + 16 * j];
+      }
+      for (var i = 0u; i < rm; i++) {
+        for (var j = 0u; j < rn; j++) {
+          sum[i * rn + j] += dot4_i8(a[i], b[j]);
+        }
+      }
     }
+    workgroupBarrier();
+  }
 
-    input_gradient[x_index] = sum;
+  for (var i = 0u; i < rm; i++) {
+    for (var j = 0u; j < rn; j++) {
+      let m = m0 + local.y + 16 * i;
+      let n = n0 + local.x + 16 * j;
+      if (m < batch_size && n < y_size) {
+        output[n + y_size * m] =
+            real(f32(sum[i * rn + j]) * scales[n] + f32(bias[n]));
+      }
+    }
+  }
 }
 
-@compute @workgroup_size(8, 8, 1)
-fn fn_weights_gradient(@builtin(global_invocation_id) id: vec3<u32>) {
-  var x_index = id.x;
-  var y_index = id.y;
-  if (x_index >= x_size || y_index >= y_size) {
-    return;
+// input_gradient[batch][x] = sum_y output_gradient[batch][y] * weights[y][x]
+//   M = batch_size, N = x_size, K = y_size.
+@compute @workgroup_size(16, 16, 1)
+fn fn_input_gradient(@builtin(workgroup_id) group: vec3<u32>,
+                     @builtin(local_invocation_id) local: vec3<u32>,
+                     @builtin(local_invocation_index) index: u32) {
+  const rm = input_gradient_rm;
+  const rn = input_gradient_rn;
+  const tm = 16 * rm;
+  const tn = 16 * rn;
+  let m0 = group.y * tm;
+  let n0 = group.x * tn;
+
+  var sum: array<f32, rm * rn>;
+  for (var k0 = 0u; k0 < y_size; k0 += tile_k) {
+    // A is contiguous along k, B along n.
+    for (var i = index; i < tm * tile_k; i += 256) {
+      let k = i % tile_k;
+      let m = i / tile_k;
+      var value = 0.0;
+      if (m0 + m < batch_size && k0 + k < y_size) {
+        value = f32(output_gradient[(k0 + k) + y_size * (m0 + m)]);
+      }
+      tile_a[k * tm + m] = value;
+    }
+    for (var i = index; i < tn * tile_k; i += 256) {
+      let n = i % tn;
+      let k = i / tn;
+      var value = 0.0;
+      if (n0 + n < x_size && k0 + k < y_size) {
+        value = f32(weights[(n0 + n) + x_size * (k0 + k)]);
+      }
+      tile_b[k * tn + n] = value;
+    }
+    workgroupBarrier();
+
+    for (var k = 0u; k < tile_k; k++) {
+      var a: array<f32, rm>;
+      var b: array<f32, rn>;
+      for (var i = 0u; i < rm; i++) {
+        a[i] = tile_a[k * tm + local.y + 16 * i];
+      }
+      for (var j = 0u; j < rn; j++) {
+        b[j] = tile_b[k * tn + local.x + 16 * j];
+      }
+      for (var i = 0u; i < rm; i++) {
+        for (var j = 0u; j < rn; j++) {
+          sum[i * rn + j] += a[i] * b[j];
+        }
+      }
+    }
+    workgroupBarrier();
   }
 
-  let w = x_index + x_size * y_index;
+  for (var i = 0u; i < rm; i++) {
+    for (var j = 0u; j < rn; j++) {
+      let m = m0 + local.y + 16 * i;
+      let n = n0 + local.x + 16 * j;
+      if (m < batch_size && n < x_size) {
+        input_gradient[n + x_size * m] = real(sum[i * rn + j]);
+      }
+    }
+  }
+}
 
-  var sum : f32 = 0.0;
-  for(var batch = 0u; batch < batch_size; batch++) {
-    sum += input[x_index] * output_gradient[y_index];
-    x_index += x_size; // Next batch.
-    y_index += y_size; // Next batch.
+// weights_gradient[y][x] = sum_batch output_gradient[batch][y] * input[batch][x]
+//   M = y_size, N = x_size, K = batch_size.
+//
+// With few weights, there are too few tiles to occupy the GPU. The batch is
+// then split into `weights_gradient_splits` chunks, one per workgroup along z.
+// Each chunk writes its partial sums, and fn_weights_gradient_reduce adds them.
+@compute @workgroup_size(16, 16, 1)
+fn fn_weights_gradient(@builtin(workgroup_id) group: vec3<u32>,
+                       @builtin(local_invocation_id) local: vec3<u32>,
+                       @builtin(local_invocation_index) index: u32) {
+  const rm = weights_gradient_rm;
+  const rn = weights_gradient_rn;
+  const tm = 16 * rm;
+  const tn = 16 * rn;
+  let m0 = group.y * tm;
+  let n0 = group.x * tn;
+  let k_begin = group.z * weights_gradient_chunk;
+  let k_end = min(k_begin + weights_gradient_chunk, batch_size);
+
+  var sum: array<f32, rm * rn>;
+  for (var k0 = k_begin; k0 < k_end; k0 += tile_k) {
+    // A is contiguous along m, B along n.
+    for (var i = index; i < tm * tile_k; i += 256) {
+      let m = i % tm;
+      let k = i / tm;
+      var value = 0.0;
+      if (m0 + m < y_size && k0 + k < k_end) {
+        value = f32(output_gradient[(m0 + m) + y_size * (k0 + k)]);
+      }
+      tile_a[k * tm + m] = value;
+    }
+    for (var i = index; i < tn * tile_k; i += 256) {
+      let n = i % tn;
+      let k = i / tn;
+      var value = 0.0;
+      if (n0 + n < x_size && k0 + k < k_end) {
+        value = f32(input[(n0 + n) + x_size * (k0 + k)]);
+      }
+      tile_b[k * tn + n] = value;
+    }
+    workgroupBarrier();
+
+    for (var k = 0u; k < tile_k; k++) {
+      var a: array<f32, rm>;
+      var b: array<f32, rn>;
+      for (var i = 0u; i < rm; i++) {
+        a[i] = tile_a[k * tm + local.y + 16 * i];
+      }
+      for (var j = 0u; j < rn; j++) {
+        b[j] = tile_b[k * tn + local.x + 16 * j];
+      }
+      for (var i = 0u; i < rm; i++) {
+        for (var j = 0u; j < rn; j++) {
+          sum[i * rn + j] += a[i] * b[j];
+        }
+      }
+    }
+    workgroupBarrier();
   }
 
-  weights_gradient[w] = sum;
+  for (var i = 0u; i < rm; i++) {
+    for (var j = 0u; j < rn; j++) {
+      let m = m0 + local.y + 16 * i;
+      let n = n0 + local.x + 16 * j;
+      if (m < y_size && n < x_size) {
+        if (weights_gradient_splits == 1) {
+          weights_gradient[n + x_size * m] = real(sum[i * rn + j]);
+        } else {
+          let split_offset = x_size * y_size * group.z;
+          weights_gradient_partial[n + x_size * m + split_offset] =
+              sum[i * rn + j];
+        }
+      }
+    }
+  }
+}
+
+@compute @workgroup_size(64, 1, 1)
+fn fn_weights_gradient_reduce(@builtin(global_invocation_id) id: vec3<u32>) {
+  let w = id.x;
+  if (w >= x_size * y_size) {
+    return;
+  }
+
+  var sum : f32 = 0.0;
+  for (var split = 0u; split < weights_gradient_splits; split++) {
+    sum += weights_gradient_partial[w + x_size * y_size * split];
+  }
+  weights_gradient[w] = real(sum);
 }
 
 @compute @workgroup_size(64, 1, 1)
@@ -86,8 +351,8 @@ fn fn_bias_gradient(@builtin(global_invocation_id) id: vec3<u32>) {
 
   var sum : f32 = 0.0;
   for(var batch = 0u; batch < batch_size; batch++) {
-    sum += output_gradient[y + y_size * batch];
+    sum += f32(output_gradient[y + y_size * batch]);
   }
 
-  bias_gradient[y] = sum;
+  bias_gradient[y] = real(sum);
 }
@@ -1,3 +1,4 @@
+#include <cmath>
 #include <iostream>
 #include <random>
 #include "Example.hpp"
@@ -108,6 +109,236 @@ TEST(Linear, Forward_Backward) {
   EXPECT_EQ(bias_gradients, expected_bias_gradient);
 }
 
+TEST(Linear, WeightsGradientLargeBatch) {
+  GPU gpu;
+
+  // Few weights and a large batch: the batch is reduced in parallel chunks.
+  const int batch_size = 1000;
+  const int input_size = 3;
+  const int output_size = 2;
+
+  std::vector<float> input_values(input_size * batch_size);
+  std::vector<float> output_gradient_values(output_size * batch_size);
+  for (int i = 0; i < input_values.size(); ++i) {
+    input_values[i] = (i % 7) - 3;
+  }
+  for (int i = 0; i < output_gradient_values.size(); ++i) {
+    output_gradient_values[i] = (i % 5) - 2;
+  }
+
+  Node input = Input(gpu, {input_size, batch_size});
+  input->outputs[0].Write(gpu, input_values);
+  Node linear = Linear(input, {output_size});
+  linear->outputs_gradients[0].Write(gpu, output_gradient_values);
+  linear->Backward();
+
+  std::vector<float> expected(input_size * output_size, 0.f);
+  for (int b = 0; b < batch_size; ++b) {
+    for (int y = 0; y < output_size; ++y) {
+      for (int x = 0; x < input_size; ++x) {
+        expected[x + input_size * y] +=
+            output_gradient_values[y + output_size * b] *
+            input_values[x + input_size * b];
+      }
+    }
+  }
+  EXPECT_EQ(linear->weights_gradients[0].Read(gpu), expected);
+}
+
+TEST(Linear, HalfPrecision) {
+  GPU gpu(GPUOptions{.half_precision = true});
+  if (!gpu.HalfPrecision()) {
+    GTEST_SKIP() << "shader-f16 is not supported.";
+  }
+
+  // An odd number of values, to check the padding of f16 tensors.
+  Node input = Input(gpu, {3, 1});
+  input->outputs[0].Write(gpu, {1.f, 0.5f, -2.f});
+  EXPECT_EQ(input->outputs[0].Read(gpu), std::vector<float>({1.f, 0.5f, -2.f}));
+
+  Node linear = Linear(input, {3});
+  linear->weights[0].Write(gpu, {
+                                    1, 2, 3,  // Output 0
+                                    4, 5, 6,  // Output 1
+                                    7, 8, 9,  // Output 2
+                                });
+  linear->weights[1].Write(gpu, {0.1f, 0.2f, 0.3f});
+  linear->Forward();
+
+  // f16 has 11 bits of precision.
+  const std::vector<float> output = linear->outputs[0].Read(gpu);
+  const std::vector<float> expected_output = {-3.9f, -5.3f, -6.7f};
+  for (int i = 0; i < output.size(); ++i) {
+    EXPECT_NEAR(output[i], expected_output[i], 1e-2);
+  }
+}
+
+TEST(Linear, Int8) {
+  GPU gpu;
+
+  // 5 inputs leave a partially packed word.
+  Node input = Input(gpu, {5, 4}, /*training=*/false);
+  Node linear = Linear(input, {3});
+
+  std::vector<std::vector<float>> examples(8);
+  for (int i = 0; i < examples.size(); ++i) {
+    for (int j = 0; j < 5; ++j) {
+      examples[i].push_back(std::sin(float(5 * i + j)));
+    }
+  }
+  auto predict = [&] {
+    return Predict()
+        .Input(input, [&](int i) { return std::span(examples[i]); })
+        .Output(linear)
+        .Size(examples.size());
+  };
+
+  const std::vector<std::vector<float>> expected = predict().Execute();
+  predict().Quantize();
+  const std::vector<std::vector<float>> quantized = predict().Execute();
+  EXPECT_FALSE(linear->weights[0].Buffer());
+
+  // Each product is rounded to about 1% of the largest input and weight.
+  ASSERT_EQ(quantized.size(), expected.size());
+  for (int i = 0; i < expected.size(); ++i) {
+    for (int j = 0; j < 3; ++j) {
+      EXPECT_NEAR(quantized[i][j], expected[i][j], 0.05);
+    }
+  }
+}
+
+TEST(Linear, InferenceOnly) {
+  GPU gpu;
+
+  Node input = Input(gpu, {3, 2}, /*training=*/false);
+  input->outputs[0].Write(gpu, {
+                                   1, 2, 3,  // Batch 0
+                                   4, 5, 6,  // Batch 1
+                               });
+
+  Node linear = Linear(input, {3});
+  EXPECT_FALSE(linear->training());
+  linear->weights[0].Write(gpu, {
+                                    1, 2, 3,  // Output 0
+                                    4, 5, 6,  // Output 1
+                                    7, 8, 9,  // Output 2
+                                });
+  linear->weights[1].Write(gpu, {1000, 2000, 3000});
+  linear->Forward();
+
+  const std::vector<float> expected_output = {
+      1014, 2032, 3050,  // Batch 0
+      1032, 2077, 3122,  // Batch 1
+  };
+  EXPECT_EQ(linear->outputs[0].Read(gpu), expected_output);
+
+  // No memory is allocated for the training state.
+  EXPECT_FALSE(input->outputs_gradients[0].Buffer());
+  EXPECT_FALSE(linear->outputs_gradients[0].Buffer());
+  for (int i = 0; i < linear->weights.size(); ++i) {
+    EXPECT_FALSE(linear->weights_gradients[i].Buffer());
+    EXPECT_FALSE(linear->weights_gradients_squared_sum[i].Buffer());
+    EXPECT_FALSE(linear->weights_momentum[i].Buffer());
+  }
+}
+
+TEST(Linear, FusedOptimizer) {
+  GPU gpu;
+
+  Node input = Input(gpu, {3, 2});
+  Node a = Linear(input, {3});
+  Node b = Linear(a, {2});
+  std::vector<NodePtr> nodes = {a.get(), b.get()};
+
+  // Moving the parameters into the fused buffers keeps their values.
+  std::vector<std::vector<float>> weights;
+  std::vector<std::vector<float>> gradients;
+  for (NodePtr node : nodes) {
+    for (int i = 0; i < node->weights.size(); ++i) {
+      weights.push_back(node->weights[i].Read(gpu));
+      gradients.push_back({});
+      for (int j = 0; j < node->weights[i].TotalSize(); ++j) {
+        gradients.back().push_back(0.1f * (j + 1));
+      }
+    }
+  }
+  FusedOptimizer optimizer(gpu, nodes);
+  int k = 0;
+  for (NodePtr node : nodes) {
+    for (int i = 0; i < node->weights.size(); ++i, ++k) {
+      EXPECT_EQ(node->weights[i].Read(gpu), weights[k]);
+      node->weights_gradients[i].Write(gpu, gradients[k]);
+    }
+  }
+
+  NodeImpl::SetLearningRate(gpu, 0.5f);
+  optimizer.UpdateParameters();
+
+  // Expect a single step of the optimizer, starting from the initial state.
+  k = 0;
+  for (NodePtr node : nodes) {
+    for (int i = 0; i < node->weights.size(); ++i, ++k) {
+      const std::vector<float> updated = node->weights[i].Read(gpu);
+      for (int j = 0; j < updated.size(); ++j) {
+        const float gradient = gradients[k][j];
+        const float squared_sum = 0.01f * gradient * gradient + 0.99f;
+        const float momentum = 0.1f * gradient;
+        const float expected =
+            weights[k][j] - 0.5f * momentum / std::sqrt(squared_sum);
+        EXPECT_NEAR(updated[j], expected, 1e-4);
+      }
+    }
+  }
+}
+
+TEST(Linear, MixedPrecision) {
+  GPU gpu(GPUOptions{.half_precision = true});
+  if (!gpu.HalfPrecision()) {
+    GTEST_SKIP() << "shader-f16 is not supported.";
+  }
+
+  Node input = Input(gpu, {3, 1});
+  Node linear = Linear(input, {3});
+  std::vector<NodePtr> nodes = {linear.get()};
+  FusedOptimizer optimizer(gpu, nodes);
+  const float scale = optimizer.LossScale();
+  EXPECT_EQ(scale, 65536.f);
+
+  // The gradients are computed for the scaled loss.
+  const std::vector<float> weights = linear->weights[0].Read(gpu);
+  std::vector<float> gradients;
+  for (int j = 0; j < weights.size(); ++j) {
+    gradients.push_back(0.1f * (j + 1));
+  }
+  std::vector<float> scaled_gradients;
+  for (float gradient : gradients) {
+    scaled_gradients.push_back(gradient * scale);
+  }
+  linear->weights_gradients[0].Write(gpu, scaled_gradients);
+  linear->weights_gradients[1].Fill(gpu, 0.f);
+
+  NodeImpl::SetLearningRate(gpu, 0.5f);
+  optimizer.UpdateParameters();
+
+  const std::vector<float> updated = linear->weights[0].Read(gpu);
+  for (int j = 0; j < updated.size(); ++j) {
+    const float gradient = gradients[j];
+    const float squared_sum = 0.01f * gradient * gradient + 0.99f;
+    const float momentum = 0.1f * gradient;
+    const float expected =
+        weights[j] - 0.5f * momentum / std::sqrt(squared_sum);
+    EXPECT_NEAR(updated[j], expected, 2e-3);
+  }
+  EXPECT_EQ(optimizer.LossScale(), scale);
+
+  // An overflowing gradient skips the step, and halves the scale.
+  scaled_gradients[0] = 1e6f;
+  linear->weights_gradients[0].Write(gpu, scaled_gradients);
+  optimizer.UpdateParameters();
+  EXPECT_EQ(linear->weights[0].Read(gpu), updated);
+  EXPECT_EQ(optimizer.LossScale(), scale / 2);
+}
+
 TEST(Linear, Training) {
   GPU gpu;
   const int batch_size = 256;
@@ -152,6 +383,102 @@ TEST(Linear, Training) {
   EXPECT_NEAR(params_b.at(0), 1, 0.1);
 }
 
+// Like Linear.Training, with one Model per step. The loss scale and the master
+// weights must carry over from one Model to the next.
+TEST(Linear, MixedPrecisionTraining) {
+  GPU gpu(GPUOptions{.half_precision = true});
+  if (!gpu.HalfPrecision()) {
+    GTEST_SKIP() << "shader-f16 is not supported.";
+  }
+  const int batch_size = 256;
+
+  Node x = Input(gpu, {2, batch_size});
+  Node y = Input(gpu, {1, batch_size});
+  Node l = Linear(x, {1});
+  Node loss = HuberLoss(Difference(l, y));
+
+  // z = 3*x + 2*y + 1.
+  static std::mt19937 rng;
+  std::normal_distribution<float> random(0.0, 4);
+  std::vector<std::vector<float>> input_data;
+  std::vector<std::vector<float>> output_data;
+  for (int i = 0; i < batch_size; ++i) {
+    const float x = random(rng);
+    const float y = random(rng);
+    input_data.push_back({x, y});
+    output_data.push_back({3 * x + 2 * y + 1});
+  }
+
+  for (int i = 0; i < 1500; ++i) {
+    Model()
+        .Input(x, [&](int i) { return std::span(input_data[i]); })
+        .Input(y, [&](int i) { return std::span(output_data[i]); })
+        .Size(input_data.size())
+        .Minimize(loss)
+        .LearningRate(0.02f)
+        .Epochs(1)
+        .Execute();
+  }
+
+  std::vector<float> params_a = l->weights[0].Read(gpu);
+  std::vector<float> params_b = l->weights[1].Read(gpu);
+  EXPECT_NEAR(params_a.at(0), 3, 0.1);
+  EXPECT_NEAR(params_a.at(1), 2, 0.1);
+  EXPECT_NEAR(params_b.at(0), 1, 0.1);
+
+  // The scale lowered by the first overflowing steps is kept.
+  std::vector<NodePtr> nodes = {l.get()};
+  EXPECT_LT(FusedOptimizer(gpu, nodes).LossScale(), 65536.f);
+}
+
+// Two Models over the same graph, built before training. The parameters are
+// packed once, so both train the weights the graph reads.
+TEST(Linear, TrainingTwoModels) {
+  GPU gpu;
+  const int batch_size = 256;
+
+  Node x = Input(gpu, {2, batch_size});
+  Node y = Input(gpu, {1, batch_size});
+  Node l = Linear(x, {1});
+  Node loss = HuberLoss(Difference(l, y));
+
+  // z = 3*x + 2*y + 1.
+  static std::mt19937 rng;
+  std::normal_distribution<float> random(0.0, 4);
+  std::vector<std::vector<float>> input_data;
+  std::vector<std::vector<float>> output_data;
+  for (int i = 0; i < batch_size; ++i) {
+    const float x = random(rng);
+    const float y = random(rng);
+    input_data.push_back({x, y});
+    output_data.push_back({3 * x + 2 * y + 1});
+  }
+
+  auto model = [&] {
+    Model model;
+    model.Input(x, [&](int i) { return std::span(input_data[i]); })
+        .Input(y, [&](int i) { return std::span(output_data[i]); })
+        .Size(input_data.size())
+        .Minimize(loss)
+        .LearningRate(0.02f)
+        .Epochs(1);
+    return model;
+  };
+  Model model_a = model();
+  Model model_b = model();
+  model_a.Execute();
+  model_b.Execute();
+  for (int i = 0; i < 1500; ++i) {
+    model_a.Execute();
+  }
+
+  std::vector<float> params_a = l->weights[0].Read(gpu);
+  std::vector<float> params_b = l->weights[1].Read(gpu);
+  EXPECT_NEAR(params_a.at(0), 3, 0.1);
+  EXPECT_NEAR(params_a.at(1), 2, 0.1);
+  EXPECT_NEAR(params_b.at(0), 1, 0.1);
+}
+
 TEST(Linear, MNIST) {
   // Load the MNIST dataset:
   auto mnist = mnist::read_dataset<std::vector, std::vector, float, uint8_t>(
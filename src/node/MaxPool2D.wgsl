@@ -9,12 +9,12 @@ const input_size = input_dx * input_dy * batch_size;
 const output_size = output_dx * output_dy * batch_size;
 
 // Input
-@group(0) @binding(0) var<storage, read_write> input: array<f32, input_size>;
-@group(0) @binding(1) var<storage, read_write> input_gradient: array<f32, input_size>;
+@group(0) @binding(0) var<storage, read_write> input: array<real, input_size>;
+@group(0) @binding(1) var<storage, read_write> input_gradient: array<real, input_size>;
 
 // Output
-@group(0) @binding(2) var<storage, read_write> output: array<f32, output_size>;
-@group(0) @binding(3) var<storage, read_write> output_gradient: array<f32, output_size>;
+@group(0) @binding(2) var<storage, read_write> output: array<real, output_size>;
+@group(0) @binding(3) var<storage, read_write> output_gradient: array<real, output_size>;
 
 @compute @workgroup_size(1, 1, 64)
 fn fn_output(@builtin(global_invocation_id) id: vec3<u32>) {
@@ -26,7 +26,10 @@ fn fn_output(@builtin(global_invocation_id) id: vec3<u32>) {
     return;
   }
 
-  var max_value : f32 = -3.402823466e+38;
+  var max_value = input[(kernel_size * x) + input_dx * (
+                        (kernel_size * y) + input_dy * (
+                        b
+  ))];
   for (var j : u32 = 0; j < kernel_size; j++) {
     for (var i : u32 = 0; i < kernel_size; i++) {
       let input_index = (i + kernel_size * x) + input_dx * (
@@ -68,6 +71,8 @@ fn fn_input_gradient(@builtin(global_invocation_id) id: vec3<u32>) {
       let input_value = input[input_index];
       if (input_value == output[output_index]) {
         input_gradient[input_index] = output_gradient_value;
+      } else {
+        input_gradient[input_index] = 0.0;
       }
     }
   } 
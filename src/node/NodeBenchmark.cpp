@@ -0,0 +1,265 @@
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "GPU.hpp"
+#include "GPUProfiler.hpp"
+#include "Node.hpp"
+#include "Tensor.hpp"
+#include "benchmark/benchmark.h"
+#include "fmt/format.h"
+#include "fmt/ranges.h"
+
+// Micro-benchmarks of the forward and backward passes of every node, over a
+// grid of shapes and batch sizes.
+//
+// The time is the GPU time of the node's dispatches, measured by the
+// GPUProfiler. The benchmarks also report:
+// - bytes_per_second: The tensors the pass must read and write at least, per
+//   second. The kernels reading a value several times aren't credited more.
+// - FLOPS: The floating point operations per second.
+//
+// Usage:
+//   ./benchmarks [--software_adapter] [--half_precision] [--benchmark_...]
+//
+// --software_adapter runs on SwiftShader, for machines without a GPU. See the
+// SWIFTSHADER CMake option.
+
+namespace {
+
+std::unique_ptr<GPU> g_gpu;
+
+struct NodeCase {
+  std::string name;
+  // The sizes of the inputs, without the batch dimension.
+  std::vector<int> sizes;
+  int inputs = 1;
+  std::function<Node(std::vector<Node>& inputs)> make;
+  // The floating point operations of the forward pass, per example. The
+  // backward pass counts twice as many: the input gradient and the weights
+  // gradient.
+  double flops = 0.0;
+};
+
+uint64_t ByteSize(std::vector<Tensor>& tensors) {
+  uint64_t size = 0;
+  for (Tensor& tensor : tensors) {
+    size += tensor.ByteSize(*g_gpu);
+  }
+  return size;
+}
+
+void BenchmarkNode(benchmark::State& state,
+                   const NodeCase& node_case,
+                   bool backward) {
+  GPU& gpu = *g_gpu;
+  const int batch_size = state.range(0);
+
+  std::vector<int> sizes = node_case.sizes;
+  sizes.push_back(batch_size);
+  std::vector<Node> inputs;
+  for (int i = 0; i < node_case.inputs; ++i) {
+    inputs.push_back(Input(gpu, sizes));
+    inputs.back()->outputs[0].FillRandomGaussian(gpu, 0.5f, 0.1f);
+  }
+  Node node = node_case.make(inputs);
+  node->outputs_gradients[0].FillRandomGaussian(gpu, 0.f, 0.1f);
+
+  auto run = [&] {
+    gpu.BeginStep();
+    if (backward) {
+      node->Backward();
+    } else {
+      node->Forward();
+    }
+    gpu.EndStep();
+    gpu.WaitAll();
+  };
+
+  // The backward pass reads the outputs of the forward pass.
+  gpu.BeginStep();
+  node->Forward();
+  gpu.EndStep();
+  run();
+
+  GPUProfiler& profiler = *gpu.Profiler();
+  for (auto _ : state) {
+    profiler.Reset();
+    run();
+    double milliseconds = 0.0;
+    for (const GPUProfiler::Entry& entry : profiler.Entries()) {
+      milliseconds += entry.milliseconds;
+    }
+    state.SetIterationTime(milliseconds / 1000.0);
+  }
+
+  uint64_t input_bytes = 0;
+  for (Node& input : inputs) {
+    input_bytes += ByteSize(input->outputs);
+  }
+  const uint64_t weight_bytes = ByteSize(node->weights);
+  const uint64_t output_bytes = ByteSize(node->outputs);
+  const uint64_t bytes =
+      backward ? 2 * input_bytes + 2 * weight_bytes + output_bytes
+               : input_bytes + weight_bytes + output_bytes;
+  const double flops = node_case.flops * batch_size * (backward ? 2 : 1);
+  state.SetBytesProcessed(state.iterations() * bytes);
+  state.counters["FLOPS"] = benchmark::Counter(state.iterations() * flops,
+                                               benchmark::Counter::kIsRate);
+}
+
+std::vector<NodeCase> NodeCases() {
+  using Inputs = std::vector<Node>&;
+  return {
+      {
+          .name = "Linear(128)",
+          .sizes = {784},
+          .make = [](Inputs in) { return Linear(in[0], {128}); },
+          .flops = 2.0 * 784 * 128,
+      },
+      {
+          .name = "Linear(1024)",
+          .sizes = {1024},
+          .make = [](Inputs in) { return Linear(in[0], {1024}); },
+          .flops = 2.0 * 1024 * 1024,
+      },
+      {
+          .name = "Conv2D(k=5,c=32)",
+          .sizes = {28, 28, 1},
+          .make = [](Inputs in) { return Conv2D(in[0], 5, 32); },
+          .flops = 2.0 * 24 * 24 * 32 * 5 * 5 * 1,
+      },
+      {
+          .name = "Conv2D(k=3,c=32)",
+          .sizes = {32, 32, 16},
+          .make = [](Inputs in) { return Conv2D(in[0], 3, 32); },
+          .flops = 2.0 * 30 * 30 * 32 * 3 * 3 * 16,
+      },
+      {
+          .name = "Conv2D(k=3,c=32,s=2)",
+          .sizes = {33, 33, 16},
+          .make = [](Inputs in) { return Conv2D(in[0], 3, 32, 2); },
+          .flops = 2.0 * 16 * 16 * 32 * 3 * 3 * 16,
+      },
+      {
+          .name = "Conv2DTranspose(k=2,c=16,s=2)",
+          .sizes = {14, 14, 32},
+          .make = [](Inputs in) { return Conv2DTranspose(in[0], 2, 16, 2); },
+          .flops = 2.0 * 14 * 14 * 16 * 2 * 2 * 32,
+      },
+      {
+          .name = "MaxPool2D(2)",
+          .sizes = {28, 28, 32},
+          .make = [](Inputs in) { return MaxPool2D(in[0], 2); },
+          .flops = 28.0 * 28 * 32,
+      },
+      {
+          .name = "Softmax",
+          .sizes = {1000},
+          .make = [](Inputs in) { return Softmax(in[0]); },
+          .flops = 4.0 * 1000,
+      },
+      {
+          .name = "BatchNormalization",
+          .sizes = {28, 28, 32},
+          .make = [](Inputs in) { return BatchNormalization(in[0]); },
+          .flops = 6.0 * 28 * 28 * 32,
+      },
+      {
+          .name = "ReLU",
+          .sizes = {65536},
+          .make = [](Inputs in) { return ReLU(in[0]); },
+          .flops = 65536.0,
+      },
+      {
+          .name = "LeakyReLU",
+          .sizes = {65536},
+          .make = [](Inputs in) { return LeakyReLU(in[0]); },
+          .flops = 65536.0,
+      },
+      {
+          .name = "Sigmoid",
+          .sizes = {65536},
+          .make = [](Inputs in) { return Sigmoid(in[0]); },
+          .flops = 3.0 * 65536,
+      },
+      {
+          .name = "Squared",
+          .sizes = {1000},
+          .make = [](Inputs in) { return Squared(in[0]); },
+          .flops = 1000.0,
+      },
+      {
+          .name = "HuberLoss",
+          .sizes = {1000},
+          .make = [](Inputs in) { return HuberLoss(in[0]); },
+          .flops = 3.0 * 1000,
+      },
+      {
+          .name = "Difference",
+          .sizes = {1000},
+          .inputs = 2,
+          .make = [](Inputs in) { return Difference(in[0], in[1]); },
+          .flops = 1000.0,
+      },
+      {
+          .name = "CrossEntropy",
+          .sizes = {1000},
+          .inputs = 2,
+          .make = [](Inputs in) { return CrossEntropy(in[0], in[1]); },
+          .flops = 3.0 * 1000,
+      },
+  };
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  benchmark::Initialize(&argc, argv);
+
+  // The flags left by benchmark::Initialize().
+  GPUOptions options{.profile = true};
+  int unrecognized = 1;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--software_adapter") == 0) {
+      options.software_adapter = true;
+    } else if (std::strcmp(argv[i], "--half_precision") == 0) {
+      options.half_precision = true;
+    } else {
+      argv[unrecognized++] = argv[i];
+    }
+  }
+  argc = unrecognized;
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+
+  g_gpu = std::make_unique<GPU>(options);
+  benchmark::AddCustomContext("adapter", g_gpu->Name());
+  benchmark::AddCustomContext("timestamps",
+                              g_gpu->Profiler()->Timestamps() ? "yes" : "no");
+  benchmark::AddCustomContext("precision",
+                              g_gpu->HalfPrecision() ? "f16" : "f32");
+
+  for (const NodeCase& node_case : NodeCases()) {
+    for (bool backward : {false, true}) {
+      const std::string name =
+          fmt::format("{}/{}/{}", node_case.name,
+                      fmt::join(node_case.sizes, "x"),
+                      backward ? "backward" : "forward");
+      benchmark::RegisterBenchmark(name, BenchmarkNode, node_case, backward)
+          ->ArgName("batch")
+          ->Arg(1)
+          ->Arg(16)
+          ->Arg(64)
+          ->UseManualTime()
+          ->Unit(benchmark::kMicrosecond);
+    }
+  }
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  g_gpu.reset();
+  return 0;
+}
@@ -1,87 +1,114 @@
 #include "node/NodePipeline.hpp"
+#include <algorithm>
 #include "fmt/format.h"
 
 void NodePipeline::Init(wgpu::ShaderModule module,
                         std::vector<Tensor*> tensors) {
   module_ = module;
+  tensors_ = tensors;
+  Bind();
+}
 
-  std::vector<wgpu::BindGroupLayoutEntry> bindGroupLayoutEntries;
-  for (uint32_t i = 0; i < tensors.size(); i++) {
-    bindGroupLayoutEntries.push_back({
-        .binding = i,
-        .visibility = wgpu::ShaderStage::Compute,
-        .buffer =
-            {
-                .type = wgpu::BufferBindingType::Storage,
-                .minBindingSize = tensors[i]->TotalSize() * sizeof(float),
-            },
-    });
+// Tensors without memory, like the gradients of an inference-only node, are
+// left out of the layout. Only the entry points not using them can run.
+void NodePipeline::BindLayout() {
+  GPU::Bindings bindings;
+  for (uint32_t i = 0; i < tensors_.size(); i++) {
+    if (tensors_[i]->Buffer()) {
+      bindings.push_back({i, tensors_[i]->ByteSize(gpu_)});
+    }
   }
 
-  wgpu::BindGroupLayoutDescriptor bindGroupLayoutDescriptor{
-      .label = "Bind group layout",
-      .entryCount = bindGroupLayoutEntries.size(),
-      .entries = bindGroupLayoutEntries.data(),
-  };
+  const GPU::Layout& layout = gpu_.CachedLayout(bindings);
+  bindGroupLayout_ = layout.bind_group_layout;
+  pipeline_layout_ = layout.pipeline_layout;
 
-  std::vector<wgpu::BindGroupLayout> bindGroupLayouts{
-      gpu_.Device().CreateBindGroupLayout(&bindGroupLayoutDescriptor),
-  };
+  // The pipelines depend on the layout. Compile them in the background, so
+  // that the first Run() only waits for the ones it uses.
+  pipelines_.clear();
+  gpu_.PrecompileComputePipelines(module_, pipeline_layout_);
+}
 
-  // Create the pipeline layout:
-  wgpu::PipelineLayoutDescriptor pipelineLayoutDescriptor{
-      .label = "Pipeline layout",
-      .bindGroupLayoutCount = bindGroupLayouts.size(),
-      .bindGroupLayouts = bindGroupLayouts.data(),
-  };
-  pipeline_layout_ =
-      gpu_.Device().CreatePipelineLayout(&pipelineLayoutDescriptor);
+void NodePipeline::Bind() {
+  // Rebuild the layout when a tensor gains or loses its memory.
+  bool same_layout =
+      bindGroupLayout_ && bound_buffers_.size() == tensors_.size();
+  for (size_t i = 0; same_layout && i < tensors_.size(); i++) {
+    same_layout = bool(tensors_[i]->Buffer()) == bool(bound_buffers_[i]);
+  }
+  if (!same_layout) {
+    BindLayout();
+  }
 
-  // Create a compute pipeline that applies the shader module to the buffer:
+  bound_buffers_.clear();
+  bound_offsets_.clear();
   std::vector<wgpu::BindGroupEntry> bindGroupEntries;
-  for (uint32_t i = 0; i < tensors.size(); i++) {
+  for (uint32_t i = 0; i < tensors_.size(); i++) {
+    bound_buffers_.push_back(tensors_[i]->Buffer());
+    bound_offsets_.push_back(tensors_[i]->Offset());
+    if (!tensors_[i]->Buffer()) {
+      continue;
+    }
     bindGroupEntries.push_back({
         .binding = i,
-        .buffer = tensors[i]->Buffer(),
-        .size = tensors[i]->TotalSize() * sizeof(float),
+        .buffer = tensors_[i]->Buffer(),
+        .offset = tensors_[i]->Offset(),
+        .size = tensors_[i]->ByteSize(gpu_),
     });
   };
   wgpu::BindGroupDescriptor bindGroupDescriptor{
       .label = "Bind group",
-      .layout = bindGroupLayouts[0],
+      .layout = bindGroupLayout_,
       .entryCount = bindGroupEntries.size(),
       .entries = bindGroupEntries.data(),
   };
   bindGroup_ = gpu_.Device().CreateBindGroup(&bindGroupDescriptor);
 }
 
+bool NodePipeline::IsBound() {
+  for (size_t i = 0; i < tensors_.size(); i++) {
+    if (tensors_[i]->Buffer().Get() != bound_buffers_[i].Get() ||
+        tensors_[i]->Offset() != bound_offsets_[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
 void NodePipeline::Run(std::string entrypoint,
                        int x_size,
                        int y_size,
                        int z_size) {
-  wgpu::CommandEncoder encoder = gpu_.Device().CreateCommandEncoder();
-  wgpu::ComputePassEncoder compute_pass = encoder.BeginComputePass();
-  compute_pass.SetPipeline(GetPipeline(entrypoint));
-  compute_pass.SetBindGroup(0, bindGroup_);
-  compute_pass.DispatchWorkgroups(x_size, y_size, z_size);
-  compute_pass.End();
-  wgpu::CommandBuffer commands = encoder.Finish();
-  gpu_.Device().GetQueue().Submit(1, &commands);
+  if (!IsBound()) {
+    Bind();
+  }
+
+  gpu_.Record({
+      .pipeline = GetPipeline(entrypoint),
+      .bind_group = bindGroup_,
+      .x = uint32_t(x_size),
+      .y = uint32_t(y_size),
+      .z = uint32_t(z_size),
+      .tensors = tensors_,
+      .node = gpu_.ProfileNode(),
+      .phase = gpu_.ProfilePhase(),
+      .entry_point = entrypoint,
+  });
+}
+
+void NodePipeline::RunFlat(std::string entrypoint,
+                           int invocations,
+                           int workgroup_size) {
+  const int workgroups = (invocations + workgroup_size - 1) / workgroup_size;
+  const int x = std::max(1, std::min(workgroups, 65535));
+  const int y = (workgroups + x - 1) / x;
+  Run(entrypoint, x, y);
 }
 
 wgpu::ComputePipeline& NodePipeline::GetPipeline(std::string entrypoint) {
   if (pipelines_.count(entrypoint) == 0) {
-    wgpu::ComputePipelineDescriptor description = {
-        .label = "Compute pipeline",
-        .layout = pipeline_layout_,
-        .compute =
-            {
-                .module = module_,
-                .entryPoint = entrypoint.c_str(),
-            },
-    };
-
-    pipelines_[entrypoint] = gpu_.Device().CreateComputePipeline(&description);
+    pipelines_[entrypoint] =
+        gpu_.CachedComputePipeline(module_, pipeline_layout_, entrypoint);
   }
   return pipelines_[entrypoint];
 }
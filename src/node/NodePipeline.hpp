@@ -17,14 +17,30 @@ class NodePipeline {
            int x_size = 1,
            int y_size = 1,
            int z_size = 1);
+  // Run `invocations` invocations of an entry point whose workgroups are
+  // 1-dimensional, of `workgroup_size` invocations. The workgroups are split
+  // over x and y, since x is limited to 65535 of them. The shader gets the
+  // index of the invocation with flat_index(), see Shader().
+  void RunFlat(std::string entrypoint, int invocations, int workgroup_size);
 
  private:
   GPU& gpu_;
   wgpu::ComputePipeline& GetPipeline(std::string entrypoint);
+
+  // The bind group is recreated when a tensor moves to a different memory.
+  void Bind();
+  void BindLayout();
+  bool IsBound();
+
   wgpu::ShaderModule module_;
+  wgpu::BindGroupLayout bindGroupLayout_;
   wgpu::PipelineLayout pipeline_layout_;
   wgpu::BindGroup bindGroup_;
   std::map<std::string, wgpu::ComputePipeline> pipelines_;
+
+  std::vector<Tensor*> tensors_;
+  std::vector<wgpu::Buffer> bound_buffers_;
+  std::vector<uint64_t> bound_offsets_;
 };
 
 #endif  // NEURAL_WEBGPU_NODE_PIPELINE_HPP_
@@ -1,12 +1,12 @@
 const size : u32 = {};
 
 // Input
-@group(0) @binding(0) var<storage, read_write> input: array<f32, size>;
-@group(0) @binding(1) var<storage, read_write> input_gradient: array<f32, size>;
+@group(0) @binding(0) var<storage, read_write> input: array<real, size>;
+@group(0) @binding(1) var<storage, read_write> input_gradient: array<real, size>;
 
 // Output
-@group(0) @binding(2) var<storage, read_write> output: array<f32, size>;
-@group(0) @binding(3) var<storage, read_write> output_gradient: array<f32, size>;
+@group(0) @binding(2) var<storage, read_write> output: array<real, size>;
+@group(0) @binding(3) var<storage, read_write> output_gradient: array<real, size>;
 
 @compute @workgroup_size(64, 1, 1)
 fn fn_output(@builtin(global_invocation_id) id: vec3<u32>) {
@@ -36,11 +36,10 @@ Node Softmax(Node input) {
                              });
     }
 
-    void Forward() override {
-      pipeline_.Run("fn_output", size_, (batch_size_ + 63) / 64);
-    }
+    // One workgroup per row, see Softmax.wgsl.
+    void Forward() override { pipeline_.Run("fn_output", batch_size_); }
     void Backward() override {
-      pipeline_.Run("fn_input_gradient", size_, (batch_size_ + 63) / 64);
+      pipeline_.Run("fn_input_gradient", batch_size_);
     }
 
     NodePipeline pipeline_{gpu()};
@@ -2,57 +2,84 @@ const size : u32 = {};
 const batch_size : u32 = {};
 
 // Input
-@group(0) @binding(0) var<storage, read_write> input: array<f32, size * batch_size>;
-@group(0) @binding(1) var<storage, read_write> input_gradient: array<f32, size * batch_size>;
+@group(0) @binding(0) var<storage, read_write> input: array<real, size * batch_size>;
+@group(0) @binding(1) var<storage, read_write> input_gradient: array<real, size * batch_size>;
 
 // Output
-@group(0) @binding(2) var<storage, read_write> output: array<f32, size * batch_size>;
-@group(0) @binding(3) var<storage, read_write> output_gradient: array<f32, size * batch_size>;
-
-@compute @workgroup_size(1, 64, 1)
-fn fn_output(@builtin(global_invocation_id) id: vec3<u32>) {
-  let x = id.x;
-  let b = id.y;
-  if (x >= size || b >= batch_size) {
-    return;
+@group(0) @binding(2) var<storage, read_write> output: array<real, size * batch_size>;
+@group(0) @binding(3) var<storage, read_write> output_gradient: array<real, size * batch_size>;
+
+// One workgroup per row. The invocations reduce the row together in
+// workgroup memory, and then write its elements.
+const workgroup_size = 64u;
+var<workgroup> partial: array<f32, workgroup_size>;
+
+fn reduce_max(local: u32, value: f32) -> f32 {
+  partial[local] = value;
+  workgroupBarrier();
+  for (var stride = workgroup_size / 2; stride > 0; stride /= 2) {
+    if (local < stride) {
+      partial[local] = max(partial[local], partial[local + stride]);
+    }
+    workgroupBarrier();
+  }
+  let result = partial[0];
+  workgroupBarrier();
+  return result;
+}
+
+fn reduce_sum(local: u32, value: f32) -> f32 {
+  partial[local] = value;
+  workgroupBarrier();
+  for (var stride = workgroup_size / 2; stride > 0; stride /= 2) {
+    if (local < stride) {
+      partial[local] += partial[local + stride];
+    }
+    workgroupBarrier();
   }
+  let result = partial[0];
+  workgroupBarrier();
+  return result;
+}
+
+@compute @workgroup_size(workgroup_size, 1, 1)
+fn fn_output(@builtin(workgroup_id) group: vec3<u32>,
+             @builtin(local_invocation_index) local: u32) {
+  let row = group.x * size;
 
   // Use the "stable" softmax algorithm
   // https://timvieira.github.io/blog/post/2014/02/11/exp-normalize-trick/
-  var best = input[b * size];
-  for (var i = 1u; i < size; i++) {
-    let index = b * size + i;
-    let value = input[index];
-    best = max(best, value);
+  var best = f32(input[row]);
+  for (var i = local; i < size; i += workgroup_size) {
+    best = max(best, f32(input[row + i]));
   }
+  best = reduce_max(local, best);
 
   var sum = 0.0;
-  for (var i = 0u; i < size; i++) {
-    let index = b * size + i;
-    let value = input[index];
-    sum += exp(value - best);
+  for (var i = local; i < size; i += workgroup_size) {
+    sum += exp(f32(input[row + i]) - best);
   }
+  sum = reduce_sum(local, sum);
 
-  let index = b * size + x;
-  let value = input[index];
-  output[index] = exp(value - best) / sum;
+  for (var i = local; i < size; i += workgroup_size) {
+    output[row + i] = real(exp(f32(input[row + i]) - best) / sum);
+  }
 }
 
-@compute @workgroup_size(1, 64, 1)
-fn fn_input_gradient(@builtin(global_invocation_id) id: vec3<u32>) {
-  let x = id.x;
-  let b = id.y;
-  if (x >= size || b >= batch_size) {
-    return;
-  }
-  
+@compute @workgroup_size(workgroup_size, 1, 1)
+fn fn_input_gradient(@builtin(workgroup_id) group: vec3<u32>,
+                     @builtin(local_invocation_index) local: u32) {
+  let row = group.x * size;
+
   var sum = 0.0;
-  for(var i = 0u; i < size; i++) {
-    let index = b * size + i;
-    sum += output[index] * output_gradient[index];
+  for (var i = local; i < size; i += workgroup_size) {
+    sum += f32(output[row + i]) * f32(output_gradient[row + i]);
   }
+  sum = reduce_sum(local, sum);
 
-  let index = b * size + x;
-  let value = input[index];
-  input_gradient[index] = output[index] * (output_gradient[index] - sum);
+  for (var i = local; i < size; i += workgroup_size) {
+    let index = row + i;
+    let y = f32(output[index]);
+    input_gradient[index] = real(y * (f32(output_gradient[index]) - sum));
+  }
 }
@@ -0,0 +1,51 @@
+#include <algorithm>
+#include <cmath>
+#include "GPU.hpp"
+#include "Node.hpp"
+#include "Tensor.hpp"
+#include "gtest/gtest.h"
+
+TEST(Softmax, Forward_Backward) {
+  GPU gpu;
+
+  // Rows larger than a workgroup, and rows smaller than one.
+  for (int size : {1000, 3}) {
+    const int batch_size = 3;
+
+    std::vector<float> input_values(size * batch_size);
+    std::vector<float> output_gradient_values(size * batch_size);
+    for (int i = 0; i < input_values.size(); ++i) {
+      input_values[i] = 0.01f * (i % 37) + 100.f * (i / size);
+      output_gradient_values[i] = (i % 5) - 2;
+    }
+
+    Node input = Input(gpu, {size, batch_size});
+    input->outputs[0].Write(gpu, input_values);
+    Node softmax = Softmax(input);
+    softmax->outputs_gradients[0].Write(gpu, output_gradient_values);
+    softmax->Forward();
+    softmax->Backward();
+
+    const std::vector<float> output = softmax->outputs[0].Read(gpu);
+    const std::vector<float> input_gradient =
+        input->outputs_gradients[0].Read(gpu);
+    for (int b = 0; b < batch_size; ++b) {
+      const float* x = input_values.data() + b * size;
+      const float* dy = output_gradient_values.data() + b * size;
+      const float best = *std::max_element(x, x + size);
+      double sum = 0.0;
+      for (int i = 0; i < size; ++i) {
+        sum += std::exp(x[i] - best);
+      }
+      double dot = 0.0;
+      for (int i = 0; i < size; ++i) {
+        dot += std::exp(x[i] - best) / sum * dy[i];
+      }
+      for (int i = 0; i < size; ++i) {
+        const double y = std::exp(x[i] - best) / sum;
+        EXPECT_NEAR(output[b * size + i], y, 1e-6);
+        EXPECT_NEAR(input_gradient[b * size + i], y * (dy[i] - dot), 1e-6);
+      }
+    }
+  }
+}
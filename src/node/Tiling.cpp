@@ -0,0 +1,41 @@
+#include "node/Tiling.hpp"
+
+#include <algorithm>
+
+namespace {
+
+int RegisterTile(int size) {
+  if (size >= 64) {
+    return 4;
+  }
+  if (size >= 32) {
+    return 2;
+  }
+  return 1;
+}
+
+int Workgroups(int size, int register_tile) {
+  return (size + 16 * register_tile - 1) / (16 * register_tile);
+}
+
+constexpr int kMaxWorkgroups = 65535;
+
+}  // namespace
+
+Tiling::Tiling(int m_size, int n_size)
+    : rm(RegisterTile(m_size)),
+      rn(RegisterTile(n_size)),
+      groups_x(Workgroups(n_size, rn)),
+      groups_y(std::min(Workgroups(m_size, rm), kMaxWorkgroups)),
+      groups_z((Workgroups(m_size, rm) + groups_y - 1) / groups_y) {}
+
+int SplitChunk(int k_size, const Tiling& tiling) {
+  constexpr int kTargetWorkgroups = 256;
+  constexpr int kMinChunk = 64;
+  const int tiles = tiling.groups_x * tiling.groups_y * tiling.groups_z;
+  const int splits = std::clamp(kTargetWorkgroups / tiles, 1,
+                                std::max(1, k_size / kMinChunk));
+  const int chunk = (k_size + splits - 1) / splits;
+  // Round to the K tile of the shaders.
+  return (chunk + 15) / 16 * 16;
+}
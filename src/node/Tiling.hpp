@@ -0,0 +1,29 @@
+#ifndef NEURAL_WEBGPU_TILING_HPP_
+#define NEURAL_WEBGPU_TILING_HPP_
+
+// The tiling of the matrix multiplications C[M][N] = A[M][K] x B[K][N] used
+// by the nodes. A workgroup of 16x16 invocations computes a tile of
+// (16 * rm) x (16 * rn) values of C. Each invocation keeps rm x rn values in
+// registers. See Linear.wgsl.
+struct Tiling {
+  Tiling(int m_size, int n_size);
+
+  // Large matrices use more registers per invocation for more reuse, small
+  // ones avoid wasting invocations on padding.
+  int rm = 1;
+  int rn = 1;
+
+  // The workgroups to dispatch: x along N, y along M. The workgroups along M
+  // over the 65535 limit of a dimension are folded into z, so the shaders
+  // compute the row of tiles as `group.y + group.z * num_workgroups.y`.
+  int groups_x = 1;
+  int groups_y = 1;
+  int groups_z = 1;
+};
+
+// When C has too few tiles to occupy the GPU, the reduction over K is split
+// into chunks computed in parallel, whose partial sums are added by a second
+// pass. Returns the number of values of K per chunk.
+int SplitChunk(int k_size, const Tiling& tiling);
+
+#endif  // NEURAL_WEBGPU_TILING_HPP_